@@ -0,0 +1,61 @@
+#include "tdmm.h"
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// Measures t_gcollect pause time against heap size. Half of the blocks are
+// reachable from a global list and the other half are garbage, interleaved
+// so the collector has to mark, skip and free across the whole heap.
+
+typedef struct Node {
+    struct Node* next;
+    char pad[56];
+} Node;
+
+Node* root;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static __attribute__((noinline)) void build(size_t blocks) {
+    root = NULL;
+    for (size_t i = 0; i < blocks / 2; i++) {
+        Node* node = t_malloc(sizeof(Node));
+        node->next = root;
+        root = node;
+        memset(t_malloc(sizeof(Node)), 0, sizeof(Node));
+    }
+}
+
+static double run(alloc_strat_e strat, size_t blocks) {
+    t_init(strat);
+    build(blocks);
+    double start = now_ns();
+    t_gcollect();
+    double elapsed = now_ns() - start;
+    root = NULL;
+    return elapsed / 1e6;
+}
+
+int main(void) {
+    const char* names[] = {"first_fit", "best_fit", "worst_fit", "buddy"};
+    alloc_strat_e strats[] = {FIRST_FIT, BEST_FIT, WORST_FIT, BUDDY};
+
+    printf("%-12s", "blocks");
+    for (int s = 0; s < 4; s++) {
+        printf("%14s", names[s]);
+    }
+    printf("   (ms per t_gcollect, half the blocks garbage)\n");
+
+    for (size_t blocks = 4096; blocks <= 1048576; blocks *= 4) {
+        printf("%-12zu", blocks);
+        for (int s = 0; s < 4; s++) {
+            printf("%14.2f", run(strats[s], blocks));
+        }
+        printf("\n");
+    }
+    return 0;
+}
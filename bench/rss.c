@@ -0,0 +1,107 @@
+#include "tdmm.h"
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+
+// Reports resident set size through an ExtremeLarge-style workload (1MB to
+// 64MB blocks) and a Fragmentation-style one (16B to 64KB blocks), first
+// with every byte kept mapped and then with direct mappings and trimming on.
+// Pinned frees 1000B and 4000B blocks in address order under one block
+// that stays live above them, so free spans grow a block at a time and
+// nothing can go back by shrinking the top of the heap.
+// Each run happens in a fresh child process so earlier heaps do not count.
+
+#define LARGE_BLOCKS 40
+#define SMALL_BLOCKS 20000
+#define PINNED_BLOCKS 50000
+
+static uint64_t rng_state;
+
+static uint64_t next_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double rss_mb(void) {
+    long pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        if (fscanf(statm, "%*d %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * (double)sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+// run: with pin, a block allocated after all the others stays live until
+// the last figure is taken, and the first 60% are freed in order rather
+// than at random.
+static void run(const char* name, const size_t* sizes, int num_sizes, int count, int pin) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child != 0) {
+        waitpid(child, NULL, 0);
+        return;
+    }
+
+    void** ptrs = calloc(count, sizeof(void*));
+    rng_state = 0x9E3779B97F4A7C15ULL;
+    t_init(FIRST_FIT);
+    double start = rss_mb();
+
+    for (int i = 0; i < count; i++) {
+        size_t size = sizes[next_rand() % num_sizes];
+        ptrs[i] = t_malloc(size);
+        memset(ptrs[i], 1, size);
+    }
+    void* pinned = pin ? t_malloc(64) : NULL;
+    double peak = rss_mb();
+
+    for (int i = 0; i < count; i++) {
+        if (pin ? i < count / 10 * 6 : next_rand() % 10 < 6) {
+            t_free(ptrs[i]);
+            ptrs[i] = NULL;
+        }
+    }
+    double partial = rss_mb();
+
+    for (int i = 0; i < count; i++) {
+        t_free(ptrs[i]);
+    }
+    double end = rss_mb();
+    t_free(pinned);
+
+    printf("%-14s %10.1f %10.1f %14.1f %10.1f\n", name, start, peak, partial, end);
+    exit(0);
+}
+
+static void run_all(void) {
+    size_t large[7];
+    for (int i = 0; i < 7; i++) {
+        large[i] = (size_t)1 << (20 + i);
+    }
+    size_t small[] = {16, 256, 4096, 65536};
+    size_t medium[] = {1000, 4000};
+
+    printf("%-14s %10s %10s %14s %10s   (RSS in MB)\n",
+           "workload", "start", "peak", "60% freed", "all freed");
+    run("ExtremeLarge", large, 7, LARGE_BLOCKS, 0);
+    run("Fragmentation", small, 4, SMALL_BLOCKS, 0);
+    run("Pinned", medium, 2, PINNED_BLOCKS, 1);
+}
+
+int main(void) {
+    printf("== everything stays mapped ==\n");
+    t_set_mmap_threshold(0);
+    t_set_trim_threshold(SIZE_MAX);
+    run_all();
+
+    printf("\n== direct mappings and trimming (defaults) ==\n");
+    t_set_mmap_threshold(128 * 1024);
+    t_set_trim_threshold(128 * 1024);
+    run_all();
+    return 0;
+}
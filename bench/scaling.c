@@ -0,0 +1,96 @@
+#include "tdmm.h"
+#include <stdint.h>
+#include <time.h>
+
+// Measures t_malloc/t_free latency against a growing number of live blocks.
+// Every other live block is freed first so the heap is full of small holes,
+// which is the case where a linear search over the block list hurts most.
+// The fit searches descend a treap, so the blocks and bins they visit grow
+// with log n rather than staying constant; the second table shows that.
+
+#define OPS 20000
+
+static const size_t sizes[] = {16, 256, 4096};
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t next_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// run: ns per t_free + t_malloc pair; *steps receives the blocks and bins
+// visited per arena allocation (slab-sized requests never search).
+static double run(alloc_strat_e strat, size_t live, double* steps) {
+    void** ptrs = malloc(live * sizeof(void*));
+    t_init(strat);
+    for (size_t i = 0; i < live; i++) {
+        ptrs[i] = t_malloc(sizes[next_rand() % 3]);
+    }
+    for (size_t i = 0; i < live; i += 2) {
+        t_free(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+
+    tdmm_stats_t before = t_stats();
+    double start = now_ns();
+    for (int i = 0; i < OPS; i++) {
+        size_t slot = (next_rand() % (live / 2)) * 2 + 1;
+        t_free(ptrs[slot]);
+        ptrs[slot] = t_malloc(sizes[next_rand() % 3]);
+    }
+    double elapsed = now_ns() - start;
+    tdmm_stats_t after = t_stats();
+    size_t searches = after.allocs[strat] - before.allocs[strat];
+    *steps = searches == 0 ? 0 : (double)(after.search_steps - before.search_steps) / searches;
+
+    for (size_t i = 1; i < live; i += 2) {
+        t_free(ptrs[i]);
+    }
+    free(ptrs);
+    return elapsed / OPS;
+}
+
+int main(void) {
+    const char* names[] = {"first_fit", "best_fit", "worst_fit", "buddy"};
+    alloc_strat_e strats[] = {FIRST_FIT, BEST_FIT, WORST_FIT, BUDDY};
+
+    printf("%-12s", "live_blocks");
+    for (int s = 0; s < 4; s++) {
+        printf("%14s", names[s]);
+    }
+    printf("   (ns per t_free + t_malloc)\n");
+
+    double steps[7][4];
+    int row = 0;
+    for (size_t live = 1024; live <= 65536; live *= 2, row++) {
+        printf("%-12zu", live);
+        for (int s = 0; s < 4; s++) {
+            printf("%14.1f", run(strats[s], live, &steps[row][s]));
+        }
+        printf("\n");
+    }
+
+    printf("\n%-12s", "live_blocks");
+    for (int s = 0; s < 4; s++) {
+        printf("%14s", names[s]);
+    }
+    printf("   (blocks/bins visited per arena allocation)\n");
+    row = 0;
+    for (size_t live = 1024; live <= 65536; live *= 2, row++) {
+        printf("%-12zu", live);
+        for (int s = 0; s < 4; s++) {
+            printf("%14.1f", steps[row][s]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,622 @@
+#include "tdmm.h"
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Native replacement for the timing half of test_tdmm.py. The Standard,
+// ExtremeLarge, HighConcurrency and Fragmentation workloads are generated
+// from a fixed seed with the same size sets and malloc/free mix as the
+// Python script, or a trace recorded by libtdmm_preload.so (TDMM_TRACE) is
+// replayed instead. Every workload runs on every strategy, plus the C
+// library's malloc as a baseline, and the results are printed as a table,
+// CSV or JSON.
+//
+//   tdmm_bench [-w workloads] [-s strategies] [-n cases] [-S seed]
+//              [-t trace] [-f table|csv|json] [-o file]
+//
+// Each call is timed on its own (rdtsc where available, clock_gettime
+// otherwise) for the latency percentiles. Throughput comes from a second,
+// untimed replay of the same operations.
+
+typedef enum { OP_MALLOC, OP_FREE, OP_REALLOC } OpKind;
+
+// One call in a workload. Pointers are replaced by slot numbers so that a
+// trace can be replayed against any allocator.
+typedef struct Op {
+    uint32_t kind;
+    uint32_t slot;
+    size_t size;
+} Op;
+
+typedef struct Trace {
+    Op* ops;
+    size_t count;
+    size_t cap;
+    uint32_t slots;
+} Trace;
+
+typedef struct Workload {
+    const char* name;
+    int mallocs;
+    int frees;
+    const size_t* sizes;    // NULL: each case picks one of size_options
+    size_t num_sizes;
+} Workload;
+
+typedef struct Strategy {
+    const char* name;
+    int strat;              // -1 for the C library
+} Strategy;
+
+static const Strategy strategies[] = {
+    {"first", FIRST_FIT}, {"best", BEST_FIT}, {"worst", WORST_FIT},
+    {"sequential", SEQUENTIAL}, {"random", RANDOM}, {"buddy", BUDDY},
+    {"libc", -1},
+};
+#define NUM_ALLOCATORS (int)(sizeof(strategies) / sizeof(strategies[0]))
+
+static const char* op_names[] = {"malloc", "free", "realloc"};
+
+static uint64_t rng_state;
+
+static uint64_t next_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void* xmalloc(size_t size) {
+    void* ptr = malloc(size);
+    if (ptr == NULL) {
+        perror("tdmm_bench");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static void trace_push(Trace* t, uint32_t kind, uint32_t slot, size_t size) {
+    if (t->count == t->cap) {
+        t->cap = t->cap == 0 ? 1024 : t->cap * 2;
+        t->ops = realloc(t->ops, t->cap * sizeof(Op));
+        if (t->ops == NULL) {
+            perror("tdmm_bench");
+            exit(EXIT_FAILURE);
+        }
+    }
+    t->ops[t->count].kind = kind;
+    t->ops[t->count].slot = slot;
+    t->ops[t->count].size = size;
+    t->count++;
+}
+
+/* ---------------------------------------------------------------- timing */
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t ticks(void) {
+    return __builtin_ia32_rdtsc();
+}
+#else
+static inline uint64_t ticks(void) {
+    return (uint64_t)now_ns();
+}
+#endif
+
+static double ns_per_tick = 1.0;
+
+// calibrate: measures the tick rate against CLOCK_MONOTONIC over 50ms.
+static void calibrate(void) {
+    double t0 = now_ns();
+    uint64_t c0 = ticks();
+    while (now_ns() - t0 < 50e6) {
+    }
+    ns_per_tick = (now_ns() - t0) / (double)(ticks() - c0);
+}
+
+/* ------------------------------------------------------------- workloads */
+
+static size_t small_sizes[256];         // 1-256
+static size_t large_sizes[4];           // 1MB-8MB
+static size_t mixed_sizes[12];          // 1 byte to 8MB in steps of 4x
+static size_t frag_pair[2] = {16, 1048576};
+static size_t full_sizes[24];           // 1 byte to 8MB in steps of 2x
+static size_t extreme_sizes[8];         // 1MB-128MB
+static size_t concurrency_sizes[497];   // 16-512
+static size_t fragmentation_sizes[4] = {16, 256, 4096, 65536};
+
+static const struct {
+    const size_t* sizes;
+    size_t count;
+} size_options[] = {
+    {small_sizes, 256}, {large_sizes, 4}, {mixed_sizes, 12},
+    {frag_pair, 2}, {full_sizes, 24},
+};
+
+static const Workload workloads[] = {
+    {"Standard", 550, 450, NULL, 0},
+    {"ExtremeLarge", 140, 60, extreme_sizes, 8},
+    {"HighConcurrency", 1800, 200, concurrency_sizes, 497},
+    {"Fragmentation", 10000, 10000, fragmentation_sizes, 4},
+};
+#define NUM_WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+static void init_sizes(void) {
+    for (int i = 0; i < 256; i++) {
+        small_sizes[i] = i + 1;
+    }
+    for (int i = 0; i < 4; i++) {
+        large_sizes[i] = (size_t)1 << (20 + i);
+    }
+    for (int i = 0; i < 12; i++) {
+        mixed_sizes[i] = (size_t)1 << (2 * i);
+    }
+    for (int i = 0; i < 24; i++) {
+        full_sizes[i] = (size_t)1 << i;
+    }
+    for (int i = 0; i < 8; i++) {
+        extreme_sizes[i] = (size_t)1 << (20 + i);
+    }
+    for (int i = 0; i < 497; i++) {
+        concurrency_sizes[i] = 16 + i;
+    }
+}
+
+// generate: one case of a workload. As in test_tdmm.py the mallocs and frees
+// are shuffled together, and each free picks a random live block (a free
+// with nothing live is dropped).
+static void generate(const Workload* w, Trace* t) {
+    const size_t* sizes = w->sizes;
+    size_t num_sizes = w->num_sizes;
+    if (sizes == NULL) {
+        size_t pick = next_rand() % (sizeof(size_options) / sizeof(size_options[0]));
+        sizes = size_options[pick].sizes;
+        num_sizes = size_options[pick].count;
+    }
+
+    int total = w->mallocs + w->frees;
+    unsigned char* is_malloc = xmalloc(total);
+    memset(is_malloc, 1, w->mallocs);
+    memset(is_malloc + w->mallocs, 0, w->frees);
+    for (int i = total - 1; i > 0; i--) {
+        int j = next_rand() % (i + 1);
+        unsigned char tmp = is_malloc[i];
+        is_malloc[i] = is_malloc[j];
+        is_malloc[j] = tmp;
+    }
+
+    uint32_t* live = xmalloc(w->mallocs * sizeof(uint32_t));
+    size_t num_live = 0;
+    for (int i = 0; i < total; i++) {
+        if (is_malloc[i]) {
+            trace_push(t, OP_MALLOC, t->slots, sizes[next_rand() % num_sizes]);
+            live[num_live++] = t->slots++;
+        } else if (num_live > 0) {
+            size_t idx = next_rand() % num_live;
+            trace_push(t, OP_FREE, live[idx], 0);
+            live[idx] = live[--num_live];
+        }
+    }
+    free(live);
+    free(is_malloc);
+}
+
+/* ---------------------------------------------------------------- traces */
+
+// PtrMap: open-addressed map from a recorded address to its slot, used to
+// turn a recorded trace into slot numbers.
+typedef struct PtrMap {
+    uint64_t* keys;
+    uint32_t* values;
+    size_t mask;
+    size_t used;
+} PtrMap;
+
+static size_t ptr_hash(uint64_t key, size_t mask) {
+    return (size_t)((key >> 4) * 0x9E3779B97F4A7C15ULL >> 20) & mask;
+}
+
+static void map_put(PtrMap* m, uint64_t key, uint32_t value);
+
+static void map_grow(PtrMap* m) {
+    PtrMap old = *m;
+    size_t cap = old.keys == NULL ? 1024 : (old.mask + 1) * 2;
+    m->keys = calloc(cap, sizeof(uint64_t));
+    m->values = xmalloc(cap * sizeof(uint32_t));
+    if (m->keys == NULL) {
+        perror("tdmm_bench");
+        exit(EXIT_FAILURE);
+    }
+    m->mask = cap - 1;
+    m->used = 0;
+    if (old.keys != NULL) {
+        for (size_t i = 0; i <= old.mask; i++) {
+            if (old.keys[i] != 0) {
+                map_put(m, old.keys[i], old.values[i]);
+            }
+        }
+        free(old.keys);
+        free(old.values);
+    }
+}
+
+static void map_put(PtrMap* m, uint64_t key, uint32_t value) {
+    if (m->keys == NULL || (m->used + 1) * 2 > m->mask + 1) {
+        map_grow(m);
+    }
+    size_t i = ptr_hash(key, m->mask);
+    while (m->keys[i] != 0 && m->keys[i] != key) {
+        i = (i + 1) & m->mask;
+    }
+    if (m->keys[i] == 0) {
+        m->used++;
+    }
+    m->keys[i] = key;
+    m->values[i] = value;
+}
+
+// map_take: removes key and returns its slot, or -1 if it is not mapped.
+// Deletion shifts later entries of the probe run back into the hole.
+static int64_t map_take(PtrMap* m, uint64_t key) {
+    if (m->keys == NULL) {
+        return -1;
+    }
+    size_t i = ptr_hash(key, m->mask);
+    while (m->keys[i] != key) {
+        if (m->keys[i] == 0) {
+            return -1;
+        }
+        i = (i + 1) & m->mask;
+    }
+    int64_t value = m->values[i];
+    size_t hole = i;
+    for (size_t j = (i + 1) & m->mask; m->keys[j] != 0; j = (j + 1) & m->mask) {
+        size_t home = ptr_hash(m->keys[j], m->mask);
+        if (((j - home) & m->mask) >= ((j - hole) & m->mask)) {
+            m->keys[hole] = m->keys[j];
+            m->values[hole] = m->values[j];
+            hole = j;
+        }
+    }
+    m->keys[hole] = 0;
+    m->used--;
+    return value;
+}
+
+// load_trace: reads a trace written by libtdmm_preload.so. Each line is one
+// call, addresses in hex:
+//   m <size> <result>           malloc, calloc and the aligned variants
+//   f <ptr>                     free
+//   r <ptr> <size> <result>     realloc
+// Frees of blocks allocated before recording started are dropped.
+static void load_trace(const char* path, Trace* t) {
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    PtrMap map = {0};
+    char line[128];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        unsigned long long ptr = 0;
+        unsigned long long size = 0;
+        unsigned long long result = 0;
+        int64_t slot;
+        if (sscanf(line, "m %llx %llx", &size, &result) == 2) {
+            if (result != 0) {
+                trace_push(t, OP_MALLOC, t->slots, size);
+                map_put(&map, result, t->slots++);
+            }
+        } else if (sscanf(line, "f %llx", &ptr) == 1) {
+            if ((slot = map_take(&map, ptr)) >= 0) {
+                trace_push(t, OP_FREE, (uint32_t)slot, 0);
+            }
+        } else if (sscanf(line, "r %llx %llx %llx", &ptr, &size, &result) == 3) {
+            slot = ptr == 0 ? -1 : map_take(&map, ptr);
+            if (slot < 0) {
+                if (result != 0) {
+                    trace_push(t, OP_MALLOC, t->slots, size);
+                    map_put(&map, result, t->slots++);
+                }
+            } else if (size == 0) {
+                trace_push(t, OP_FREE, (uint32_t)slot, 0);
+            } else if (result == 0) {
+                map_put(&map, ptr, (uint32_t)slot);
+            } else {
+                trace_push(t, OP_REALLOC, (uint32_t)slot, size);
+                map_put(&map, result, (uint32_t)slot);
+            }
+        }
+    }
+    fclose(in);
+    free(map.keys);
+    free(map.values);
+}
+
+/* ---------------------------------------------------------------- replay */
+
+typedef struct Samples {
+    uint64_t* ticks;
+    size_t count;
+    size_t cap;
+} Samples;
+
+static void sample(Samples* s, uint64_t value) {
+    if (s->count == s->cap) {
+        s->cap = s->cap == 0 ? 4096 : s->cap * 2;
+        s->ticks = realloc(s->ticks, s->cap * sizeof(uint64_t));
+        if (s->ticks == NULL) {
+            perror("tdmm_bench");
+            exit(EXIT_FAILURE);
+        }
+    }
+    s->ticks[s->count++] = value;
+}
+
+static void* do_malloc(int strat, size_t size) {
+    return strat < 0 ? malloc(size) : t_malloc(size);
+}
+
+static void do_free(int strat, void* ptr) {
+    if (strat < 0) {
+        free(ptr);
+    } else {
+        t_free(ptr);
+    }
+}
+
+static void* do_realloc(int strat, void* ptr, size_t size) {
+    return strat < 0 ? realloc(ptr, size) : t_realloc(ptr, size);
+}
+
+// replay: runs one case from a fresh heap. With samples it times each call;
+// without, it returns the time for the whole run in ticks. Blocks still live
+// at the end are freed outside the measurement.
+static uint64_t replay(const Trace* t, int strat, void** ptrs, Samples* samples) {
+    if (strat >= 0) {
+        t_init(strat);
+    }
+    memset(ptrs, 0, t->slots * sizeof(void*));
+    uint64_t start = ticks();
+    for (size_t i = 0; i < t->count; i++) {
+        const Op* op = &t->ops[i];
+        uint64_t t0 = samples != NULL ? ticks() : 0;
+        if (op->kind == OP_MALLOC) {
+            ptrs[op->slot] = do_malloc(strat, op->size);
+        } else if (op->kind == OP_FREE) {
+            do_free(strat, ptrs[op->slot]);
+            ptrs[op->slot] = NULL;
+        } else {
+            void* moved = do_realloc(strat, ptrs[op->slot], op->size);
+            if (moved != NULL) {
+                ptrs[op->slot] = moved;
+            }
+        }
+        if (samples != NULL) {
+            sample(&samples[op->kind], ticks() - t0);
+        }
+    }
+    uint64_t elapsed = ticks() - start;
+    for (uint32_t i = 0; i < t->slots; i++) {
+        do_free(strat, ptrs[i]);
+    }
+    return elapsed;
+}
+
+/* --------------------------------------------------------------- results */
+
+typedef struct Result {
+    const char* workload;
+    const char* strategy;
+    const char* op;
+    size_t count;
+    double mean_ns;
+    double p50_ns;
+    double p99_ns;
+    double p999_ns;
+    double max_ns;
+    double mops;            // whole-workload throughput, millions of calls/s
+} Result;
+
+static int compare_ticks(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const Samples* s, double p) {
+    size_t idx = (size_t)(p * (s->count - 1) + 0.5);
+    return s->ticks[idx] * ns_per_tick;
+}
+
+static void summarize(Result* r, Samples* s) {
+    qsort(s->ticks, s->count, sizeof(uint64_t), compare_ticks);
+    double sum = 0;
+    for (size_t i = 0; i < s->count; i++) {
+        sum += s->ticks[i];
+    }
+    r->count = s->count;
+    r->mean_ns = sum / s->count * ns_per_tick;
+    r->p50_ns = percentile(s, 0.50);
+    r->p99_ns = percentile(s, 0.99);
+    r->p999_ns = percentile(s, 0.999);
+    r->max_ns = s->ticks[s->count - 1] * ns_per_tick;
+}
+
+static void print_results(FILE* out, const char* format, const Result* results,
+                          size_t count, uint64_t seed, int cases) {
+    if (strcmp(format, "csv") == 0) {
+        fprintf(out, "workload,strategy,op,count,mean_ns,p50_ns,p99_ns,p999_ns,max_ns,throughput_mops\n");
+        for (size_t i = 0; i < count; i++) {
+            const Result* r = &results[i];
+            fprintf(out, "%s,%s,%s,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f\n",
+                    r->workload, r->strategy, r->op, r->count, r->mean_ns,
+                    r->p50_ns, r->p99_ns, r->p999_ns, r->max_ns, r->mops);
+        }
+    } else if (strcmp(format, "json") == 0) {
+        fprintf(out, "{\n  \"seed\": %llu,\n  \"cases\": %d,\n  \"results\": [\n",
+                (unsigned long long)seed, cases);
+        for (size_t i = 0; i < count; i++) {
+            const Result* r = &results[i];
+            fprintf(out, "    {\"workload\": \"%s\", \"strategy\": \"%s\", \"op\": \"%s\", "
+                    "\"count\": %zu, \"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, "
+                    "\"p999_ns\": %.1f, \"max_ns\": %.1f, \"throughput_mops\": %.3f}%s\n",
+                    r->workload, r->strategy, r->op, r->count, r->mean_ns, r->p50_ns,
+                    r->p99_ns, r->p999_ns, r->max_ns, r->mops, i + 1 < count ? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+    } else {
+        fprintf(out, "%-16s %-11s %-8s %9s %9s %9s %9s %10s %9s\n", "workload", "strategy",
+                "op", "count", "p50_ns", "p99_ns", "p999_ns", "max_ns", "Mops/s");
+        for (size_t i = 0; i < count; i++) {
+            const Result* r = &results[i];
+            fprintf(out, "%-16s %-11s %-8s %9zu %9.0f %9.0f %9.0f %10.0f %9.2f\n",
+                    r->workload, r->strategy, r->op, r->count, r->p50_ns, r->p99_ns,
+                    r->p999_ns, r->max_ns, r->mops);
+        }
+    }
+}
+
+// selected: whether name appears in a comma-separated list (NULL: all).
+static int selected(const char* list, const char* name) {
+    if (list == NULL) {
+        return 1;
+    }
+    size_t len = strlen(name);
+    const char* p = list;
+    while (1) {
+        if (strncasecmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) {
+            return 1;
+        }
+        p = strchr(p, ',');
+        if (p == NULL) {
+            return 0;
+        }
+        p++;
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: tdmm_bench [-w workloads] [-s strategies] [-n cases] [-S seed]\n"
+            "                  [-t trace] [-f table|csv|json] [-o file]\n"
+            "  workloads:  Standard,ExtremeLarge,HighConcurrency,Fragmentation\n"
+            "  strategies: first,best,worst,sequential,random,buddy,libc\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    const char* workload_list = NULL;
+    const char* strategy_list = NULL;
+    const char* trace_path = NULL;
+    const char* format = "table";
+    const char* out_path = NULL;
+    int cases = 20;
+    uint64_t seed = 1;
+
+    int c;
+    while ((c = getopt(argc, argv, "w:s:n:S:t:f:o:h")) != -1) {
+        switch (c) {
+        case 'w': workload_list = optarg; break;
+        case 's': strategy_list = optarg; break;
+        case 'n': cases = atoi(optarg); break;
+        case 'S': seed = strtoull(optarg, NULL, 0); break;
+        case 't': trace_path = optarg; break;
+        case 'f': format = optarg; break;
+        case 'o': out_path = optarg; break;
+        default: usage();
+        }
+    }
+    if (cases < 1 || seed == 0) {
+        usage();
+    }
+
+    init_sizes();
+    calibrate();
+
+    // Every case of every selected workload is generated up front, so all
+    // strategies replay exactly the same calls.
+    int num_sets = trace_path != NULL ? 1 : NUM_WORKLOADS;
+    const char* names[NUM_WORKLOADS];
+    Trace* sets[NUM_WORKLOADS] = {0};
+    int set_cases[NUM_WORKLOADS] = {0};
+    uint32_t max_slots = 0;
+    if (trace_path != NULL) {
+        names[0] = "trace";
+        sets[0] = calloc(1, sizeof(Trace));
+        load_trace(trace_path, sets[0]);
+        set_cases[0] = 1;
+        max_slots = sets[0]->slots;
+    } else {
+        rng_state = seed;
+        for (int w = 0; w < NUM_WORKLOADS; w++) {
+            names[w] = workloads[w].name;
+            if (!selected(workload_list, workloads[w].name)) {
+                continue;
+            }
+            sets[w] = calloc(cases, sizeof(Trace));
+            set_cases[w] = cases;
+            for (int i = 0; i < cases; i++) {
+                generate(&workloads[w], &sets[w][i]);
+                if (sets[w][i].slots > max_slots) {
+                    max_slots = sets[w][i].slots;
+                }
+            }
+        }
+    }
+
+    void** ptrs = xmalloc((max_slots + 1) * sizeof(void*));
+    Result* results = xmalloc(num_sets * NUM_ALLOCATORS * 3 * sizeof(Result));
+    size_t num_results = 0;
+    for (int w = 0; w < num_sets; w++) {
+        if (sets[w] == NULL) {
+            continue;
+        }
+        for (int s = 0; s < NUM_ALLOCATORS; s++) {
+            if (!selected(strategy_list, strategies[s].name)) {
+                continue;
+            }
+            int strat = strategies[s].strat;
+            Samples samples[3] = {{0}};
+            uint64_t elapsed = 0;
+            size_t calls = 0;
+            for (int i = 0; i < set_cases[w]; i++) {
+                replay(&sets[w][i], strat, ptrs, samples);
+            }
+            for (int i = 0; i < set_cases[w]; i++) {
+                elapsed += replay(&sets[w][i], strat, ptrs, NULL);
+                calls += sets[w][i].count;
+            }
+            double mops = calls / (elapsed * ns_per_tick) * 1e3;
+            for (int k = 0; k < 3; k++) {
+                if (samples[k].count == 0) {
+                    continue;
+                }
+                Result* r = &results[num_results++];
+                r->workload = names[w];
+                r->strategy = strategies[s].name;
+                r->op = op_names[k];
+                r->mops = mops;
+                summarize(r, &samples[k]);
+                free(samples[k].ticks);
+            }
+        }
+    }
+
+    FILE* out = stdout;
+    if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+        perror(out_path);
+        return EXIT_FAILURE;
+    }
+    print_results(out, format, results, num_results, seed, trace_path != NULL ? 1 : cases);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "tdmm.h"
+#include <pthread.h>
+#include <time.h>
+
+// Measures t_malloc/t_free throughput with 1 to 16 threads, each running
+// a HighConcurrency-style mix of 16-512 byte blocks. After the timed loop
+// every thread frees the blocks its neighbour left behind, so frees from a
+// thread other than the allocating one are exercised as well.
+
+#define OPS_PER_THREAD 1000000
+#define SLOTS 512
+#define MAX_THREADS 16
+
+typedef struct Worker {
+    pthread_t thread;
+    int id;
+    int count;
+    unsigned long long seed;
+    void* slots[SLOTS];
+} Worker;
+
+static Worker workers[MAX_THREADS];
+static pthread_barrier_t barrier;
+
+static unsigned long long next_rand(unsigned long long* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* work(void* arg) {
+    Worker* w = (Worker*)arg;
+    for (int i = 0; i < OPS_PER_THREAD; i++) {
+        int slot = next_rand(&w->seed) % SLOTS;
+        if (w->slots[slot] != NULL) {
+            t_free(w->slots[slot]);
+            w->slots[slot] = NULL;
+        } else {
+            size_t size = 16 + next_rand(&w->seed) % 497;
+            w->slots[slot] = t_malloc(size);
+            *(int*)w->slots[slot] = w->id;
+        }
+    }
+
+    pthread_barrier_wait(&barrier);
+    Worker* neighbour = &workers[(w->id + 1) % w->count];
+    for (int i = 0; i < SLOTS; i++) {
+        t_free(neighbour->slots[i]);
+        neighbour->slots[i] = NULL;
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    alloc_strat_e strat = argc > 1 ? (alloc_strat_e)atoi(argv[1]) : FIRST_FIT;
+
+    printf("%-8s %12s %12s\n", "threads", "seconds", "Mops/s");
+    for (int n = 1; n <= MAX_THREADS; n *= 2) {
+        t_init(strat);
+        pthread_barrier_init(&barrier, NULL, n);
+
+        double start = now_sec();
+        for (int i = 0; i < n; i++) {
+            workers[i].id = i;
+            workers[i].count = n;
+            workers[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+            pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+        }
+        for (int i = 0; i < n; i++) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        double elapsed = now_sec() - start;
+
+        pthread_barrier_destroy(&barrier);
+        double ops = (double)n * (OPS_PER_THREAD + SLOTS);
+        printf("%-8d %12.3f %12.2f\n", n, elapsed, ops / elapsed / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "tdmm_internal.h"
+#include <stdint.h>
+
+#define METADATA sizeof(Block)
+#define OVERHEAD (PAD + METADATA)
+#define BUDDY_MIN_ORDER 6   // 64 bytes: pad and header plus a 48-byte payload
+#define LINKS(b) (((FreeNode*)((char*)(b) + METADATA))->link)
+
+// Each arena keeps one free list per order, linked through link[0] (next)
+// and link[1] (prev) of the payload; bit k of its buddy_map is set while
+// list k is non-empty.
+
+// order_of: a block of order k spans 1 << k bytes including its pad and
+// header.
+static int order_of(Block* b) {
+    return 63 - __builtin_clzll(b->size + OVERHEAD);
+}
+
+// order_for: the smallest order whose block can hold size payload bytes.
+static int order_for(size_t size) {
+    size_t total = size + OVERHEAD;
+    int order = 64 - __builtin_clzll(total - 1);
+    return order < BUDDY_MIN_ORDER ? BUDDY_MIN_ORDER : order;
+}
+
+static void push_block(Arena* arena, Block* b, int order) {
+    b->size = ((size_t)1 << order) - OVERHEAD;
+    b->is_free = 1;
+    LINKS(b)[1] = NULL;
+    LINKS(b)[0] = arena->buddy_lists[order];
+    if (LINKS(b)[0] != NULL) {
+        LINKS(LINKS(b)[0])[1] = b;
+    }
+    arena->buddy_lists[order] = b;
+    arena->buddy_map |= 1ULL << order;
+    arena->stats.free += b->size;
+}
+
+static void unlink_block(Arena* arena, Block* b, int order) {
+    if (LINKS(b)[1] != NULL) {
+        LINKS(LINKS(b)[1])[0] = LINKS(b)[0];
+    } else {
+        arena->buddy_lists[order] = LINKS(b)[0];
+    }
+    if (LINKS(b)[0] != NULL) {
+        LINKS(LINKS(b)[0])[1] = LINKS(b)[1];
+    }
+    if (arena->buddy_lists[order] == NULL) {
+        arena->buddy_map &= ~(1ULL << order);
+    }
+    if (arena->spare == b) {
+        arena->spare = NULL;
+    }
+    arena->stats.free -= b->size;
+}
+
+// buddy_init: forgets every region of the arena.
+void buddy_init(Arena* arena) {
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        arena->buddy_lists[i] = NULL;
+    }
+    arena->buddy_map = 0;
+}
+
+// buddy_round: the payload size of the block buddy_alloc returns for size.
+size_t buddy_round(size_t size) {
+    return ((size_t)1 << order_for(size)) - OVERHEAD;
+}
+
+// buddy_add_region: base must be aligned to size, and size a power of two,
+// so a block's buddy is always its own address with one bit flipped. The
+// headers sit PAD bytes into their blocks, which the flip leaves alone.
+void buddy_add_region(Arena* arena, void* base, size_t size) {
+    Block* region = (Block*)((char*)base + PAD);
+    int order = 63 - __builtin_clzll(size);
+    *region = (Block){.arena = arena->id, .top_order = order};
+    push_block(arena, region, order);
+}
+
+// buddy_alloc: takes the smallest free block of a large enough order and
+// halves it until it matches, pushing the unused halves on their lists.
+void* buddy_alloc(Arena* arena, size_t size) {
+    if (size > ((size_t)1 << BUDDY_MAX_ORDER) - OVERHEAD) {
+        return NULL;
+    }
+    int order = order_for(size);
+    uint64_t avail = arena->buddy_map & (~0ULL << order);
+    if (avail == 0) {
+        more_memory(arena, (size_t)1 << order);
+        avail = arena->buddy_map & (~0ULL << order);
+    }
+    int k = __builtin_ctzll(avail);
+    Block* block = arena->buddy_lists[k];
+    unlink_block(arena, block, k);
+
+    // The halving steps are what the search histogram counts for BUDDY.
+    while (k > order) {
+#ifndef TDMM_NO_STATS
+        arena->stats.walk++;
+#endif
+        k--;
+        Block* half = (Block*)((char*)block + ((size_t)1 << k));
+        *half = (Block){.arena = block->arena, .top_order = block->top_order};
+        push_block(arena, half, k);
+    }
+    block->size = ((size_t)1 << order) - OVERHEAD;
+    block->is_free = 0;
+    return (char*)block + METADATA;
+}
+
+// buddy_free: merges the block with its buddy for as long as the buddy is
+// free and whole, stopping at the order of the region it came from.
+void buddy_free(Arena* arena, void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    Block* block = (Block*)((char*)ptr - METADATA);
+    int k = order_of(block);
+    // What this free adds for trim_span: the block, widened to each merged
+    // buddy too small to have been trimmed on its own. A larger buddy was
+    // trimmed when it was freed; only the page with its header stays.
+    char* lo = (char*)block - PAD;
+    char* hi = lo + ((size_t)1 << k);
+
+    while (k < block->top_order) {
+        Block* buddy = (Block*)((uintptr_t)block ^ ((uintptr_t)1 << k));
+        if (!buddy->is_free || order_of(buddy) != k) {
+            break;
+        }
+        unlink_block(arena, buddy, k);
+        if (buddy < block) {
+            block = buddy;
+        }
+        k++;
+        if (buddy->size < trim_threshold) {
+            lo = (char*)block - PAD;
+            hi = lo + ((size_t)1 << k);
+        }
+    }
+
+    push_block(arena, block, k);
+
+    // A whole free region becomes the arena's spare; the previous spare is
+    // unmapped, so one region stays mapped to absorb malloc/free churn.
+    if (k == block->top_order && trim_threshold != SIZE_MAX) {
+        Block* old = arena->spare;
+        if (old != NULL) {
+            int top = old->top_order;
+            unlink_block(arena, old, top);
+            unmap_region(arena, (char*)old - PAD, (size_t)1 << top);
+        }
+        arena->spare = block;
+    }
+    trim_span(block, lo, hi);
+}
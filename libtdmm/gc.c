@@ -0,0 +1,411 @@
+#define _GNU_SOURCE  // dl_iterate_phdr, pthread_getattr_np
+#include "tdmm_internal.h"
+#include <link.h>
+#include <string.h>
+
+#define METADATA sizeof(Block)
+#define GRANULE ALIGNMENT   // one block header per granule, PAD bytes in
+
+// Every mapping that holds blocks is recorded here, sorted by address, so
+// t_gcollect can tell which words might point at a block. The table lives in
+// its own mapping: t_gcollect must not depend on the heap it is collecting.
+typedef struct Region {
+    char* base;
+    size_t size;
+} Region;
+
+static Region* regions;
+static size_t region_count;
+static size_t region_cap;
+
+#ifdef TDMM_THREADS
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+#define REGIONS_LOCK() pthread_mutex_lock(&regions_lock)
+#define REGIONS_UNLOCK() pthread_mutex_unlock(&regions_lock)
+#else
+#define REGIONS_LOCK() ((void)0)
+#define REGIONS_UNLOCK() ((void)0)
+#endif
+
+static void* gc_map(size_t bytes) {
+    void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// region_find: index of the first region whose base is not below addr.
+static size_t region_find(char* addr) {
+    size_t lo = 0;
+    size_t hi = region_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (regions[mid].base < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// region_reset: forgets the regions of the heap t_init is abandoning. Direct
+// mappings outlive t_init (they can still be passed to t_free), so they stay.
+void region_reset(void) {
+    REGIONS_LOCK();
+    size_t kept = 0;
+    for (size_t i = 0; i < region_count; i++) {
+        Block* b = (Block*)(regions[i].base + PAD);
+        if (b->arena == DIRECT_ARENA && b->size + REGION_OVERHEAD == regions[i].size) {
+            regions[kept++] = regions[i];
+        }
+    }
+    region_count = kept;
+    REGIONS_UNLOCK();
+}
+
+void region_add(void* base, size_t size) {
+    REGIONS_LOCK();
+    if (region_count == region_cap) {
+        size_t cap = region_cap == 0 ? 256 : region_cap * 2;
+        Region* grown = gc_map(cap * sizeof(Region));
+        if (grown == NULL) {
+            perror("mmap failed to grow the region table");
+            exit(EXIT_FAILURE);
+        }
+        if (regions != NULL) {
+            memcpy(grown, regions, region_count * sizeof(Region));
+            munmap(regions, region_cap * sizeof(Region));
+        }
+        regions = grown;
+        region_cap = cap;
+    }
+    size_t i = region_find(base);
+    memmove(&regions[i + 1], &regions[i], (region_count - i) * sizeof(Region));
+    regions[i].base = base;
+    regions[i].size = size;
+    region_count++;
+    REGIONS_UNLOCK();
+}
+
+// region_remove: forgets every region inside [base, base + size). A block
+// that coalesced across adjacent regions is unmapped as one, so this can be
+// more than a single entry.
+void region_remove(void* base, size_t size) {
+    REGIONS_LOCK();
+    size_t i = region_find(base);
+    size_t j = i;
+    while (j < region_count && regions[j].base < (char*)base + size) {
+        j++;
+    }
+    memmove(&regions[i], &regions[j], (region_count - j) * sizeof(Region));
+    region_count -= j - i;
+    REGIONS_UNLOCK();
+}
+
+// lock_regions: holds the table still across fork, after the arena locks.
+void lock_regions(void) {
+    REGIONS_LOCK();
+}
+
+void unlock_regions(void) {
+    REGIONS_UNLOCK();
+}
+
+// region_resize: records that the region at base now ends at base + size.
+void region_resize(void* base, size_t size) {
+    REGIONS_LOCK();
+    regions[region_find(base)].size = size;
+    REGIONS_UNLOCK();
+}
+
+// walk_spans: calls visit for each run of adjacent regions, in address
+// order. The caller holds every arena lock, so blocks tile each run.
+void walk_spans(void (*visit)(char* base, char* end, void* arg), void* arg) {
+    REGIONS_LOCK();
+    size_t i = 0;
+    while (i < region_count) {
+        char* base = regions[i].base;
+        char* end = base + regions[i].size;
+        for (i++; i < region_count && regions[i].base == end; i++) {
+            end += regions[i].size;
+        }
+        visit(base, end, arg);
+    }
+    REGIONS_UNLOCK();
+}
+
+/*
+ * A span is a run of adjacent regions; next_block walks through one from
+ * the first header to the last fence. Each span has two bitmaps with one
+ * bit per granule: starts marks the granules holding a block header, marks
+ * records which of those blocks were found reachable.
+ */
+typedef struct Span {
+    char* base;
+    char* end;
+    uint64_t* starts;
+    uint64_t* marks;
+} Span;
+
+static Span* spans;
+static size_t span_count;
+static void* bitmaps;
+static size_t bitmaps_size;
+static char** mark_stack;     // payloads of marked objects still to scan
+static size_t mark_top;
+static size_t mark_cap;
+
+// build_spans: merges adjacent regions and records every block start.
+static int build_spans(void) {
+    span_count = 0;
+    if (region_count == 0) {
+        return 0;
+    }
+    spans = gc_map(region_count * sizeof(Span));
+    if (spans == NULL) {
+        return 0;
+    }
+    size_t words = 0;
+    for (size_t i = 0; i < region_count; i++) {
+        char* base = regions[i].base;
+        char* end = base + regions[i].size;
+        if (span_count > 0 && spans[span_count - 1].end == base) {
+            spans[span_count - 1].end = end;
+            continue;
+        }
+        spans[span_count].base = base;
+        spans[span_count].end = end;
+        span_count++;
+    }
+    for (size_t i = 0; i < span_count; i++) {
+        words += ((spans[i].end - spans[i].base) / GRANULE + 63) / 64;
+    }
+    bitmaps_size = words * 2 * sizeof(uint64_t);
+    bitmaps = gc_map(bitmaps_size);
+    if (bitmaps == NULL) {
+        munmap(spans, region_count * sizeof(Span));
+        return 0;
+    }
+    uint64_t* next = bitmaps;
+    for (size_t i = 0; i < span_count; i++) {
+        Span* s = &spans[i];
+        size_t n = ((s->end - s->base) / GRANULE + 63) / 64;
+        s->starts = next;
+        s->marks = next + n;
+        next += 2 * n;
+        for (Block* b = (Block*)(s->base + PAD); (char*)b < s->end; b = next_block(b)) {
+            size_t g = ((char*)b - s->base) / GRANULE;
+            s->starts[g / 64] |= (uint64_t)1 << (g % 64);
+        }
+    }
+    return 1;
+}
+
+static Span* span_of(char* p) {
+    size_t lo = 0;
+    size_t hi = span_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (spans[mid].end <= p) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == span_count || p < spans[lo].base) {
+        return NULL;
+    }
+    return &spans[lo];
+}
+
+// resolve: the allocated block whose payload contains p, and its granule.
+// The header at or below p is in p's granule or an earlier one; for a
+// pointer to the start of a payload it is the one just before.
+static Block* resolve(char* p, Span** span, size_t* granule) {
+    Span* s = span_of(p);
+    if (s == NULL || (size_t)(p - s->base) < PAD + METADATA) {
+        return NULL;
+    }
+    size_t gp = (p - s->base - PAD) / GRANULE;
+    size_t w = gp / 64;
+    uint64_t bits = s->starts[w];
+    if (gp % 64 != 63) {
+        bits &= ((uint64_t)2 << (gp % 64)) - 1;
+    }
+    while (bits == 0 && w > 0) {
+        bits = s->starts[--w];
+    }
+    if (bits == 0) {
+        return NULL;
+    }
+    size_t g = w * 64 + 63 - __builtin_clzll(bits);
+    Block* b = (Block*)(s->base + g * GRANULE + PAD);
+    if (b->is_free || b->arena == FENCE_ARENA ||
+        p < (char*)b + METADATA || p >= (char*)b + METADATA + b->size) {
+        return NULL;
+    }
+    *span = s;
+    *granule = g;
+    return b;
+}
+
+static void push(char* obj) {
+    if (mark_top == mark_cap) {
+        size_t cap = mark_cap == 0 ? 4096 : mark_cap * 2;
+        char** grown = gc_map(cap * sizeof(char*));
+        if (grown == NULL) {
+            perror("mmap failed to grow the mark stack");
+            exit(EXIT_FAILURE);
+        }
+        if (mark_stack != NULL) {
+            memcpy(grown, mark_stack, mark_top * sizeof(char*));
+            munmap(mark_stack, mark_cap * sizeof(char*));
+        }
+        mark_stack = grown;
+        mark_cap = cap;
+    }
+    mark_stack[mark_top++] = obj;
+}
+
+// mark: marks the block or slab slot p points into and returns its payload,
+// or NULL if p does not point into one or it was already marked.
+static char* mark(char* p) {
+    if (IS_SLAB(p)) {
+        return slab_mark(p);
+    }
+    Span* s;
+    size_t g;
+    Block* b = resolve(p, &s, &g);
+    if (b == NULL) {
+        return NULL;
+    }
+    uint64_t bit = (uint64_t)1 << (g % 64);
+    if (s->marks[g / 64] & bit) {
+        return NULL;
+    }
+    s->marks[g / 64] |= bit;
+    return (char*)b + METADATA;
+}
+
+static size_t object_size(char* obj) {
+    return IS_SLAB(obj) ? slab_usable_size(obj) : ((Block*)(obj - METADATA))->size;
+}
+
+// scan_range: treats every word in [lo, hi) as a possible pointer, taken at
+// pointer-size steps from lo.
+static void scan_range(void* lo, void* hi) {
+    for (char* p = lo; p + sizeof(void*) <= (char*)hi; p += sizeof(void*)) {
+        char* word;
+        memcpy(&word, p, sizeof(word));
+        char* obj = mark(word);
+        if (obj != NULL) {
+            push(obj);
+        }
+    }
+}
+
+// scan_stack: scans another thread's stack. The main thread's stack is
+// reported at its full rlimit size but only the part it has grown into is
+// mapped, so pages mincore rejects are skipped.
+static void scan_stack(void* lo, void* hi) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    unsigned char resident;
+    char* p = (char*)((uintptr_t)lo & ~(uintptr_t)(page - 1));
+    for (; p < (char*)hi; p += page) {
+        if (mincore(p, page, &resident) != 0) {
+            continue;
+        }
+        scan_range(p < (char*)lo ? lo : p, p + page > (char*)hi ? hi : p + page);
+    }
+}
+
+// mark_cached: an object in a thread cache is free to the program but still
+// allocated to its slab, so it must survive without keeping anything alive.
+static void mark_cached(void* ptr) {
+    mark(ptr);
+}
+
+static int scan_segments(struct dl_phdr_info* info, size_t size, void* data) {
+    (void)size;
+    (void)data;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+        if (ph->p_type == PT_LOAD && (ph->p_flags & PF_W)) {
+            char* lo = (char*)info->dlpi_addr + ph->p_vaddr;
+            scan_range(lo, lo + ph->p_memsz);
+        }
+    }
+    return 0;
+}
+
+// collect: marks from every root, then chains the unmarked allocated blocks
+// and slab slots through their first payload word. Runs with every arena locked.
+static __attribute__((noinline)) void* collect(char* stack_hi) {
+    void* here = NULL;
+    void* garbage = NULL;
+
+    REGIONS_LOCK();
+    if (!build_spans()) {
+        REGIONS_UNLOCK();
+        return NULL;
+    }
+    visit_threads(scan_stack, mark_cached);
+    scan_range(&here, stack_hi);
+    dl_iterate_phdr(scan_segments, NULL);
+
+    while (mark_top > 0) {
+        char* obj = mark_stack[--mark_top];
+        scan_range(obj, obj + object_size(obj));
+    }
+
+    for (size_t i = 0; i < span_count; i++) {
+        Span* s = &spans[i];
+        for (Block* b = (Block*)(s->base + PAD); (char*)b < s->end; b = next_block(b)) {
+            size_t g = ((char*)b - s->base) / GRANULE;
+            if (b->is_free || b->arena == FENCE_ARENA || (s->marks[g / 64] >> (g % 64)) & 1) {
+                continue;
+            }
+            void* payload = (char*)b + METADATA;
+            *(void**)payload = garbage;
+            garbage = payload;
+        }
+    }
+    garbage = slab_sweep(garbage);
+
+    munmap(bitmaps, bitmaps_size);
+    munmap(spans, region_count * sizeof(Span));
+    REGIONS_UNLOCK();
+    return garbage;
+}
+
+// t_gcollect: frees every allocated block no root can reach (see tdmm.h).
+void t_gcollect(void) {
+    static __thread char* stack_hi;
+    if (stack_hi == NULL) {
+        pthread_attr_t attr;
+        void* stack;
+        size_t stack_size;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+            return;
+        }
+        pthread_attr_getstack(&attr, &stack, &stack_size);
+        pthread_attr_destroy(&attr);
+        stack_hi = (char*)stack + stack_size;
+    }
+
+    // Spill callee-saved registers into this frame so the stack scan in
+    // collect sees pointers that only live in registers.
+    __builtin_unwind_init();
+
+    lock_arenas();
+    void* garbage = collect(stack_hi);
+    unlock_arenas();
+
+    // Freed outside the locks: release_block takes the owning arena's lock,
+    // and direct mappings go back through region_remove.
+    while (garbage != NULL) {
+        void* next = *(void**)garbage;
+        release_block(garbage);
+        garbage = next;
+    }
+}
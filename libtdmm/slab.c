@@ -0,0 +1,306 @@
+#include "tdmm_internal.h"
+#include <string.h>
+
+#define SLAB_WORDS (SLAB_SIZE / ALIGNMENT / 64)
+#define SLAB_RESERVE ((size_t)1 << 34)  // address space set aside for slabs
+#define SLAB_COMMIT (64 * SLAB_SIZE)    // made accessible at a time
+
+/*
+ * A slab is one SLAB_SIZE page of equal slots. Slabs are carved from a
+ * range reserved for them alone, so a pointer is a slab object exactly when
+ * it falls inside the range, and its slab is the pointer with the low bits
+ * masked off. Slots carry no header: bit i of used is set while slot i is
+ * allocated, and so are the bits past the last slot.
+ */
+typedef struct Slab {
+    struct Slab* next;          // the arena's slabs of this class with free slots
+    struct Slab* prev;
+    uint32_t size;              // slot size; 0 while the page is in the pool
+    uint16_t capacity;
+    uint16_t count;             // slots in use
+    int arena;
+    uint64_t used[SLAB_WORDS];
+    uint64_t marks[SLAB_WORDS]; // t_gcollect
+} Slab;
+
+#define SLAB_OF(p) ((Slab*)((uintptr_t)(p) & ~(uintptr_t)(SLAB_SIZE - 1)))
+#define SLOTS(s) ((char*)(s) + ((sizeof(Slab) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1)))
+
+char* slab_lo;
+// End of the pages handed out so far. IS_SLAB reads it without a lock, so
+// it is only ever stored with release and read there with acquire.
+char* slab_top;
+static char* slab_committed;
+static char* slab_end;
+
+// Pages of empty slabs, ready for any class in any arena. The stack lives
+// in its own mapping, like the region table.
+static Slab** pool;
+static size_t pool_count;
+static size_t pool_cap;
+
+// The pool is only touched with an arena lock held (or by t_init), so a
+// fork that holds every arena lock never copies it mid-update.
+#ifdef TDMM_THREADS
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#define POOL_LOCK() pthread_mutex_lock(&pool_lock)
+#define POOL_UNLOCK() pthread_mutex_unlock(&pool_lock)
+#else
+#define POOL_LOCK() ((void)0)
+#define POOL_UNLOCK() ((void)0)
+#endif
+
+// lock_pool: holds the pool still across fork, after every other lock.
+void lock_pool(void) {
+    POOL_LOCK();
+}
+
+void unlock_pool(void) {
+    POOL_UNLOCK();
+}
+
+// slab_reserve: sets aside the range on first use. Only PROT_NONE address
+// space until slab_page commits it.
+static int slab_reserve(void) {
+    if (slab_end != NULL) {
+        return slab_lo != NULL;
+    }
+    void* range = mmap(NULL, SLAB_RESERVE, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (range == MAP_FAILED) {
+        slab_end = (char*)-1;   // do not try again; small requests use blocks
+        return 0;
+    }
+    slab_lo = range;
+    __atomic_store_n(&slab_top, (char*)range, __ATOMIC_RELEASE);
+    slab_committed = range;
+    slab_end = slab_lo + SLAB_RESERVE;
+    return 1;
+}
+
+// slab_page: a page for a new slab, from the pool or fresh from the range.
+// NULL once the range is used up.
+static Slab* slab_page(void) {
+    Slab* page = NULL;
+    POOL_LOCK();
+    if (pool_count > 0) {
+        page = pool[--pool_count];
+    } else if (slab_reserve()) {
+        if (slab_top == slab_committed && slab_committed < slab_end &&
+            mprotect(slab_committed, SLAB_COMMIT, PROT_READ | PROT_WRITE) == 0) {
+            slab_committed += SLAB_COMMIT;
+        }
+        if (slab_top < slab_committed) {
+            page = (Slab*)slab_top;
+            __atomic_store_n(&slab_top, slab_top + SLAB_SIZE, __ATOMIC_RELEASE);
+        }
+    }
+    POOL_UNLOCK();
+    return page;
+}
+
+// slab_release: returns an empty slab's page to the pool, and its memory
+// to the OS unless trimming is off.
+static void slab_release(Slab* s) {
+    s->size = 0;
+    if (trim_threshold != SIZE_MAX) {
+        madvise(s, SLAB_SIZE, MADV_DONTNEED);
+    }
+    POOL_LOCK();
+    if (pool_count == pool_cap) {
+        size_t cap = pool_cap == 0 ? 512 : pool_cap * 2;
+        Slab** grown = mmap(NULL, cap * sizeof(Slab*), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (grown == MAP_FAILED) {
+            // The page stays out of use; it is still inside the range, and
+            // size 0 keeps the collector and the walker off it.
+            POOL_UNLOCK();
+            return;
+        }
+        if (pool != NULL) {
+            memcpy(grown, pool, pool_count * sizeof(Slab*));
+            munmap(pool, pool_cap * sizeof(Slab*));
+        }
+        pool = grown;
+        pool_cap = cap;
+    }
+    pool[pool_count++] = s;
+    POOL_UNLOCK();
+}
+
+// slab_reset: puts every page back for t_init; objects of the old heap are
+// dead along with its blocks.
+void slab_reset(void) {
+    if (slab_top > slab_lo) {
+        madvise(slab_lo, slab_top - slab_lo, MADV_DONTNEED);
+    }
+    __atomic_store_n(&slab_top, slab_lo, __ATOMIC_RELEASE);
+    pool_count = 0;
+}
+
+static void unlink_slab(Arena* arena, Slab* s, size_t cls) {
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    } else {
+        arena->slabs[cls] = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+    s->next = NULL;
+    s->prev = NULL;
+}
+
+static void push_slab(Arena* arena, Slab* s, size_t cls) {
+    s->prev = NULL;
+    s->next = arena->slabs[cls];
+    if (s->next != NULL) {
+        s->next->prev = s;
+    }
+    arena->slabs[cls] = s;
+}
+
+// new_slab: sets up a page as an empty slab of class cls.
+static Slab* new_slab(Arena* arena, size_t cls) {
+    Slab* s = slab_page();
+    if (s == NULL) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(Slab));
+    s->size = cls * ALIGNMENT;
+    s->capacity = (SLAB_SIZE - (SLOTS(s) - (char*)s)) / s->size;
+    s->arena = arena->id;
+    for (size_t i = s->capacity; i < SLAB_WORDS * 64; i++) {
+        s->used[i / 64] |= 1ULL << (i % 64);
+    }
+    push_slab(arena, s, cls);
+    arena->mapped += SLAB_SIZE;
+    arena->stats.slab_free_bytes += (size_t)s->capacity * s->size;
+    return s;
+}
+
+// slab_alloc: a free slot of class cls; the caller holds the arena lock.
+// NULL only when no page can be had for a new slab.
+void* slab_alloc(Arena* arena, size_t cls) {
+    Slab* s = arena->slabs[cls];
+    if (s == NULL) {
+        s = new_slab(arena, cls);
+        if (s == NULL) {
+            return NULL;
+        }
+    }
+    int w = 0;
+    while (s->used[w] == ~0ULL) {
+        w++;
+    }
+    size_t i = w * 64 + __builtin_ctzll(~s->used[w]);
+    s->used[w] |= 1ULL << (i % 64);
+    if (++s->count == s->capacity) {
+        unlink_slab(arena, s, cls);
+    }
+    arena->stats.slab_free_bytes -= s->size;
+    arena->stats.in_use += s->size;
+#ifndef TDMM_NO_STATS
+    arena->stats.slab_allocs++;
+#endif
+    return SLOTS(s) + i * s->size;
+}
+
+// slab_free: releases the slot ptr points into; the caller holds the lock
+// of the slab's arena. An empty slab goes back to the pool unless it is the
+// last of its class with free slots.
+void slab_free(Arena* arena, void* ptr) {
+    Slab* s = SLAB_OF(ptr);
+    size_t cls = s->size / ALIGNMENT;
+    size_t i = ((char*)ptr - SLOTS(s)) / s->size;
+    s->used[i / 64] &= ~(1ULL << (i % 64));
+    if (s->count-- == s->capacity) {
+        push_slab(arena, s, cls);
+    }
+    arena->stats.in_use -= s->size;
+    arena->stats.slab_free_bytes += s->size;
+#ifndef TDMM_NO_STATS
+    arena->stats.slab_frees++;
+#endif
+    if (s->count == 0 && (s->prev != NULL || s->next != NULL)) {
+        unlink_slab(arena, s, cls);
+        arena->mapped -= SLAB_SIZE;
+        arena->stats.slab_free_bytes -= (size_t)s->capacity * s->size;
+        slab_release(s);
+    }
+}
+
+// slab_slot: the start of the slot ptr points into, and its size. Needs no
+// lock: a slab keeps its class while any of its slots is allocated.
+void* slab_slot(void* ptr, size_t* size) {
+    Slab* s = SLAB_OF(ptr);
+    *size = s->size;
+    return SLOTS(s) + ((char*)ptr - SLOTS(s)) / s->size * s->size;
+}
+
+int slab_arena(void* ptr) {
+    return SLAB_OF(ptr)->arena;
+}
+
+// slab_usable_size: the bytes from ptr to the end of its slot.
+size_t slab_usable_size(void* ptr) {
+    size_t size;
+    char* slot = slab_slot(ptr, &size);
+    return slot + size - (char*)ptr;
+}
+
+// slab_mark: for t_gcollect, marks the allocated slot p points into and
+// returns it, or NULL if there is none or it was already marked.
+void* slab_mark(void* p) {
+    Slab* s = SLAB_OF(p);
+    if (s->size == 0 || (char*)p < SLOTS(s)) {
+        return NULL;
+    }
+    size_t i = ((char*)p - SLOTS(s)) / s->size;
+    uint64_t bit = 1ULL << (i % 64);
+    if (i >= s->capacity || !(s->used[i / 64] & bit) || (s->marks[i / 64] & bit)) {
+        return NULL;
+    }
+    s->marks[i / 64] |= bit;
+    return SLOTS(s) + i * s->size;
+}
+
+// slab_sweep: chains every allocated slot t_gcollect did not mark onto
+// garbage through its first word, and clears the marks for next time.
+void* slab_sweep(void* garbage) {
+    for (char* page = slab_lo; page < slab_top; page += SLAB_SIZE) {
+        Slab* s = (Slab*)page;
+        if (s->size == 0) {
+            continue;
+        }
+        for (size_t i = 0; i < s->capacity; i++) {
+            uint64_t bit = 1ULL << (i % 64);
+            if ((s->used[i / 64] & bit) && !(s->marks[i / 64] & bit)) {
+                void* slot = SLOTS(s) + i * s->size;
+                *(void**)slot = garbage;
+                garbage = slot;
+            }
+        }
+        memset(s->marks, 0, sizeof(s->marks));
+    }
+    return garbage;
+}
+
+// slab_visit: reports every slot of every slab, in address order, for
+// t_walk.
+void slab_visit(void (*visit)(const tdmm_block_t* block, void* arg), void* arg) {
+    for (char* page = slab_lo; page < slab_top; page += SLAB_SIZE) {
+        Slab* s = (Slab*)page;
+        if (s->size == 0) {
+            continue;
+        }
+        for (size_t i = 0; i < s->capacity; i++) {
+            tdmm_block_t block;
+            block.addr = SLOTS(s) + i * s->size;
+            block.size = s->size;
+            block.is_free = !((s->used[i / 64] >> (i % 64)) & 1);
+            block.arena = s->arena;
+            visit(&block, arg);
+        }
+    }
+}
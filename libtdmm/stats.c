@@ -0,0 +1,131 @@
+#define _GNU_SOURCE  // mremap
+#include "tdmm_internal.h"
+#include <string.h>
+
+#define METADATA sizeof(Block)
+
+// t_stats: adds up the per-arena counters, the thread caches and the direct
+// mappings.
+tdmm_stats_t t_stats(void) {
+    tdmm_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    size_t allocated = 0;
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        Arena* arena = &arenas[i];
+#ifdef TDMM_THREADS
+        pthread_mutex_lock(&arena->lock);
+#endif
+        stats.mapped += arena->mapped;
+        allocated += arena->stats.in_use;
+        stats.free += arena->stats.free;
+        stats.slab_free_bytes += arena->stats.slab_free_bytes;
+        size_t largest = 0;
+        if (arena->buddy_map != 0) {
+            largest = ((size_t)1 << (63 - __builtin_clzll(arena->buddy_map))) - PAD - METADATA;
+        } else if (arena->addr_root != NULL) {
+            largest = ((FreeNode*)((char*)arena->addr_root + METADATA))->max_size;
+        }
+        if (largest > stats.largest_free) {
+            stats.largest_free = largest;
+        }
+        for (int s = 0; s < NUM_STRATEGIES; s++) {
+            stats.allocs[s] += arena->stats.allocs[s];
+            stats.frees[s] += arena->stats.frees[s];
+        }
+        stats.slab_allocs += arena->stats.slab_allocs;
+        stats.slab_frees += arena->stats.slab_frees;
+        stats.search_steps += arena->stats.search_steps;
+        for (int b = 0; b < SEARCH_BUCKETS; b++) {
+            stats.search_hist[b] += arena->stats.search_hist[b];
+        }
+#ifdef TDMM_THREADS
+        pthread_mutex_unlock(&arena->lock);
+#endif
+    }
+    thread_stats(&stats);
+
+    stats.mapped += __atomic_load_n(&direct_mapped, __ATOMIC_RELAXED);
+    stats.in_use = allocated + __atomic_load_n(&direct_payload, __ATOMIC_RELAXED);
+    // A cache can be read after its block was counted free again in the
+    // arena (or the other way round), so keep the subtraction from wrapping.
+    stats.in_use -= stats.cached < stats.in_use ? stats.cached : stats.in_use;
+    stats.direct_allocs = __atomic_load_n(&direct_allocs, __ATOMIC_RELAXED);
+    stats.direct_frees = __atomic_load_n(&direct_frees, __ATOMIC_RELAXED);
+    if (stats.free > 0) {
+        stats.fragmentation = 1.0 - (double)stats.largest_free / stats.free;
+    }
+    return stats;
+}
+
+// The walk copies the layout into its own mapping while the heap is locked,
+// so that the visitor can run unlocked and allocate.
+typedef struct Layout {
+    tdmm_block_t* blocks;
+    size_t count;
+    size_t cap;
+    int slabs_done;         // the slab range has its place among the spans
+} Layout;
+
+static void append(const tdmm_block_t* block, void* arg) {
+    Layout* layout = (Layout*)arg;
+    if (layout->count == layout->cap) {
+        size_t cap = layout->cap == 0 ? 4096 : layout->cap * 2;
+        void* grown = layout->blocks == NULL
+            ? mmap(NULL, cap * sizeof(tdmm_block_t), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+            : mremap(layout->blocks, layout->cap * sizeof(tdmm_block_t),
+                     cap * sizeof(tdmm_block_t), MREMAP_MAYMOVE);
+        if (grown == MAP_FAILED) {
+            return;
+        }
+        layout->blocks = grown;
+        layout->cap = cap;
+    }
+    layout->blocks[layout->count++] = *block;
+}
+
+static void copy_span(char* base, char* end, void* arg) {
+    Layout* layout = (Layout*)arg;
+    if (!layout->slabs_done && base > slab_lo) {
+        slab_visit(append, layout);
+        layout->slabs_done = 1;
+    }
+    for (Block* block = (Block*)(base + PAD); (char*)block < end; block = next_block(block)) {
+        if (block->arena == FENCE_ARENA) {
+            continue;
+        }
+        tdmm_block_t out;
+        out.addr = block;
+        out.size = block->size;
+        out.is_free = block->is_free;
+        out.arena = block->arena;
+        append(&out, layout);
+    }
+}
+
+size_t t_walk(void (*visit)(const tdmm_block_t* block, void* arg), void* arg) {
+    Layout layout = {NULL, 0, 0, 0};
+    lock_arenas();
+    walk_spans(copy_span, &layout);
+    if (!layout.slabs_done) {
+        slab_visit(append, &layout);
+    }
+    unlock_arenas();
+    for (size_t i = 0; i < layout.count; i++) {
+        visit(&layout.blocks[i], arg);
+    }
+    if (layout.blocks != NULL) {
+        munmap(layout.blocks, layout.cap * sizeof(tdmm_block_t));
+    }
+    return layout.count;
+}
+
+static void dump_block(const tdmm_block_t* block, void* arg) {
+    fprintf((FILE*)arg, "%p,%zu,%s,%d\n", block->addr, block->size,
+            block->is_free ? "free" : "used", block->arena);
+}
+
+void t_dump(FILE* out) {
+    fprintf(out, "addr,size,state,arena\n");
+    t_walk(dump_block, out);
+}
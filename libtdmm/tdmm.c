@@ -1,223 +1,1296 @@
-#include "tdmm.h"
+#define _GNU_SOURCE  // pthread_getattr_np
+#include "tdmm_internal.h"
 #include <sys/mman.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
 
 #define METADATA sizeof(Block)
-#define MIN_BLOCK_SIZE 4
+#define FOOTER sizeof(size_t)
+// PAYLOAD_SIZE: n rounded up so the block ends where the next header goes.
+#define PAYLOAD_SIZE(n) ((((n) + METADATA + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1)) - METADATA)
+#define MIN_BLOCK_SIZE PAYLOAD_SIZE(sizeof(FreeNode) + FOOTER)
+#define NODE(b) ((FreeNode*)((char*)(b) + METADATA))
+#define NEXT(b) ((Block*)((char*)(b) + METADATA + (b)->size))
+#define BUDDY_MIN_REGION (1 << 20)
+#define HEAP_RESERVE ((size_t)1 << 35)  // address space set aside per arena
+#define HEAP_MAX_STEP ((size_t)1 << 26) // most committed beyond a request at once
+#define HUGE_PAGE ((size_t)1 << 21)
+
+#ifdef TDMM_THREADS
+#define LOCK(arena) pthread_mutex_lock(&(arena)->lock)
+#define UNLOCK(arena) pthread_mutex_unlock(&(arena)->lock)
+#else
+#define LOCK(arena) ((void)0)
+#define UNLOCK(arena) ((void)0)
+#endif
+
+// Counters that only feed t_stats; byte accounting is always kept.
+#ifndef TDMM_NO_STATS
+#define STAT(expr) ((void)(expr))
+#else
+#define STAT(expr) ((void)0)
+#endif
 
 // Global variables
-void* heap_base;
-Block* free_list;
-Block* last_block;
 size_t HEAP_SIZE = 4096 * 4;
 alloc_strat_e current_strategy;
-enum RoundRobin round = FIRST;
+size_t mmap_threshold = 128 * 1024;
+size_t trim_threshold = 128 * 1024;
+size_t thp_threshold;
+size_t direct_mapped;
+size_t direct_payload;
+size_t direct_allocs;
+size_t direct_frees;
 
-// t_init: initializes the heap with mmap and sets up the free list.
-void t_init(alloc_strat_e strat) {
-    HEAP_SIZE = (HEAP_SIZE + 3) & ~3;
+// Every arena holds its own block list and free-block index: exact-size
+// bins for small blocks, treaps for the rest.
+Arena arenas[MAX_ARENAS];
+unsigned int next_arena;
+unsigned int heap_epoch;
 
-    heap_base = mmap(NULL, HEAP_SIZE, PROT_READ | PROT_WRITE,
-                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (heap_base == MAP_FAILED) {
-        perror("mmap failed");
-        exit(EXIT_FAILURE);
+// block_priority: treap priority, a mixed hash of the block address.
+static uint64_t block_priority(Block* b) {
+    uint64_t x = (uint64_t)(uintptr_t)b;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// addr_update: recomputes the subtree maximum after a child changed.
+static void addr_update(Block* t) {
+    FreeNode* n = NODE(t);
+    n->max_size = t->size;
+    if (n->left != NULL && NODE(n->left)->max_size > n->max_size) {
+        n->max_size = NODE(n->left)->max_size;
+    }
+    if (n->right != NULL && NODE(n->right)->max_size > n->max_size) {
+        n->max_size = NODE(n->right)->max_size;
+    }
+}
+
+// addr_split: splits t into blocks below key and blocks at or above key.
+static void addr_split(Block* t, Block* key, Block** lo, Block** hi) {
+    if (t == NULL) {
+        *lo = *hi = NULL;
+    } else if (t < key) {
+        addr_split(NODE(t)->right, key, &NODE(t)->right, hi);
+        addr_update(t);
+        *lo = t;
+    } else {
+        addr_split(NODE(t)->left, key, lo, &NODE(t)->left);
+        addr_update(t);
+        *hi = t;
+    }
+}
+
+// addr_merge: joins two treaps where every block in lo precedes hi.
+static Block* addr_merge(Block* lo, Block* hi) {
+    if (lo == NULL) {
+        return hi;
+    }
+    if (hi == NULL) {
+        return lo;
+    }
+    if (block_priority(lo) > block_priority(hi)) {
+        NODE(lo)->right = addr_merge(NODE(lo)->right, hi);
+        addr_update(lo);
+        return lo;
+    }
+    NODE(hi)->left = addr_merge(lo, NODE(hi)->left);
+    addr_update(hi);
+    return hi;
+}
+
+static Block* addr_insert(Block* t, Block* b) {
+    if (t == NULL || block_priority(b) > block_priority(t)) {
+        addr_split(t, b, &NODE(b)->left, &NODE(b)->right);
+        addr_update(b);
+        return b;
+    }
+    if (b < t) {
+        NODE(t)->left = addr_insert(NODE(t)->left, b);
+    } else {
+        NODE(t)->right = addr_insert(NODE(t)->right, b);
     }
+    addr_update(t);
+    return t;
+}
+
+static Block* addr_erase(Block* t, Block* b) {
+    if (t == b) {
+        return addr_merge(NODE(t)->left, NODE(t)->right);
+    }
+    if (b < t) {
+        NODE(t)->left = addr_erase(NODE(t)->left, b);
+    } else {
+        NODE(t)->right = addr_erase(NODE(t)->right, b);
+    }
+    addr_update(t);
+    return t;
+}
+
+// size_less: orders the size treap by size, then by address.
+static int size_less(Block* a, Block* b) {
+    return a->size < b->size || (a->size == b->size && a < b);
+}
+
+static void size_split(Block* t, Block* key, Block** lo, Block** hi) {
+    if (t == NULL) {
+        *lo = *hi = NULL;
+    } else if (size_less(t, key)) {
+        size_split(NODE(t)->link[1], key, &NODE(t)->link[1], hi);
+        *lo = t;
+    } else {
+        size_split(NODE(t)->link[0], key, lo, &NODE(t)->link[0]);
+        *hi = t;
+    }
+}
+
+static Block* size_merge(Block* lo, Block* hi) {
+    if (lo == NULL) {
+        return hi;
+    }
+    if (hi == NULL) {
+        return lo;
+    }
+    if (block_priority(lo) > block_priority(hi)) {
+        NODE(lo)->link[1] = size_merge(NODE(lo)->link[1], hi);
+        return lo;
+    }
+    NODE(hi)->link[0] = size_merge(lo, NODE(hi)->link[0]);
+    return hi;
+}
+
+static Block* size_insert(Block* t, Block* b) {
+    if (t == NULL || block_priority(b) > block_priority(t)) {
+        size_split(t, b, &NODE(b)->link[0], &NODE(b)->link[1]);
+        return b;
+    }
+    if (size_less(b, t)) {
+        NODE(t)->link[0] = size_insert(NODE(t)->link[0], b);
+    } else {
+        NODE(t)->link[1] = size_insert(NODE(t)->link[1], b);
+    }
+    return t;
+}
 
+static Block* size_erase(Block* t, Block* b) {
+    if (t == b) {
+        return size_merge(NODE(t)->link[0], NODE(t)->link[1]);
+    }
+    if (size_less(b, t)) {
+        NODE(t)->link[0] = size_erase(NODE(t)->link[0], b);
+    } else {
+        NODE(t)->link[1] = size_erase(NODE(t)->link[1], b);
+    }
+    return t;
+}
+
+// index_insert: makes a free block visible to the fit searches.
+static void index_insert(Arena* arena, Block* b) {
+    FreeNode* n = NODE(b);
+    n->left = NULL;
+    n->right = NULL;
+    n->link[0] = NULL;
+    n->link[1] = NULL;
+    arena->stats.free += b->size;
+    arena->addr_root = addr_insert(arena->addr_root, b);
+
+    if (b->size < SMALL_LIMIT) {
+        size_t bin = b->size >> 4;
+        n->link[0] = arena->bins[bin];
+        if (arena->bins[bin] != NULL) {
+            NODE(arena->bins[bin])->link[1] = b;
+        }
+        arena->bins[bin] = b;
+        arena->bin_map[bin / 64] |= 1ULL << (bin % 64);
+    } else {
+        arena->size_root = size_insert(arena->size_root, b);
+    }
+}
+
+// index_remove: takes a free block out of the index before it changes.
+static void index_remove(Arena* arena, Block* b) {
+    FreeNode* n = NODE(b);
+    if (arena->spare == b) {
+        arena->spare = NULL;
+    }
+    arena->stats.free -= b->size;
+    arena->addr_root = addr_erase(arena->addr_root, b);
+
+    if (b->size < SMALL_LIMIT) {
+        size_t bin = b->size >> 4;
+        if (n->link[1] != NULL) {
+            NODE(n->link[1])->link[0] = n->link[0];
+        } else {
+            arena->bins[bin] = n->link[0];
+        }
+        if (n->link[0] != NULL) {
+            NODE(n->link[0])->link[1] = n->link[1];
+        }
+        if (arena->bins[bin] == NULL) {
+            arena->bin_map[bin / 64] &= ~(1ULL << (bin % 64));
+        }
+    } else {
+        arena->size_root = size_erase(arena->size_root, b);
+    }
+}
+
+// index_lowest_fit: the lowest-addressed free block with at least size bytes.
+static Block* index_lowest_fit(Arena* arena, size_t size) {
+    Block* t = arena->addr_root;
+    if (t == NULL || NODE(t)->max_size < size) {
+        return NULL;
+    }
+    while (t != NULL) {
+        FreeNode* n = NODE(t);
+        STAT(arena->stats.walk++);
+        if (n->left != NULL && NODE(n->left)->max_size >= size) {
+            t = n->left;
+        } else if (t->size >= size) {
+            return t;
+        } else {
+            t = n->right;
+        }
+    }
+    return NULL;
+}
+
+// index_smallest_fit: a free block of the smallest size that is >= size.
+static Block* index_smallest_fit(Arena* arena, size_t size) {
+    if (size < SMALL_LIMIT) {
+        size_t bin = size >> 4;
+        for (size_t word = bin / 64; word < NUM_BINS / 64; word++) {
+            uint64_t bits = arena->bin_map[word];
+            STAT(arena->stats.walk++);
+            if (word == bin / 64) {
+                bits &= ~0ULL << (bin % 64);
+            }
+            if (bits != 0) {
+                return arena->bins[word * 64 + __builtin_ctzll(bits)];
+            }
+        }
+    }
+    Block* best = NULL;
+    Block* t = arena->size_root;
+    while (t != NULL) {
+        STAT(arena->stats.walk++);
+        if (t->size >= size) {
+            best = t;
+            t = NODE(t)->link[0];
+        } else {
+            t = NODE(t)->link[1];
+        }
+    }
+    return best;
+}
+
+// decommit: returns part of a reserved range to the OS, memory and commit
+// charge both, leaving it PROT_NONE and still reserved.
+static void decommit(void* base, size_t size) {
+    mmap(base, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+}
+
+// arena_reset: empties an arena; it maps memory again on its first t_malloc.
+static void arena_reset(Arena* arena, int id) {
+#ifdef TDMM_THREADS
+    pthread_mutex_init(&arena->lock, NULL);
+#endif
+    arena->id = id;
+    arena->round = FIRST;
+    arena->seed = (unsigned int)time(NULL) + id;
+    memset(arena->bins, 0, sizeof(arena->bins));
+    memset(arena->bin_map, 0, sizeof(arena->bin_map));
+    arena->addr_root = NULL;
+    arena->size_root = NULL;
+    arena->mapped = 0;
+    arena->spare = NULL;
+    // The reservation outlives t_init; only what was committed goes back.
+    if (arena->heap_top > arena->heap) {
+        decommit(arena->heap, arena->heap_top - arena->heap);
+        arena->heap_top = arena->heap;
+    }
+    memset(arena->slabs, 0, sizeof(arena->slabs));
+    // The counts in stats are cumulative; only the byte totals start over.
+    arena->stats.in_use = 0;
+    arena->stats.free = 0;
+    arena->stats.slab_free_bytes = 0;
+    arena->stats.walk = 0;
+    buddy_init(arena);
+}
+
+#ifdef TDMM_THREADS
+#define TCACHE_BINS (SLAB_CLASSES + 1)
+#define TCACHE_COUNT 16
+
+/*
+ * Per-thread state. The cache holds recently freed slab objects, binned by
+ * size class. Only the owning thread touches it, so it takes no lock. Cached
+ * objects still count as allocated in their slab until the cache hands them
+ * back, which is what makes frees from a foreign thread safe to cache too.
+ * Every thread that has allocated is on the threads list so t_gcollect can
+ * find its stack and cached blocks.
+ */
+typedef struct TCache {
+    void* bins[TCACHE_BINS];        // linked through the first payload word
+    unsigned char counts[TCACHE_BINS];
+    unsigned int epoch;             // heap_epoch the cached blocks belong to
+    int registered;
+    int shut_down;                  // thread_exit has run; frees go to the arena
+    size_t cached;                  // payload bytes in bins
+    size_t allocs;
+    size_t frees;
+    void* stack_lo;
+    void* stack_hi;
+    struct TCache* next;
+    struct TCache* prev;
+} TCache;
+
+static __thread TCache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static TCache* threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t retired_allocs;       // cache counts of threads that exited
+static size_t retired_frees;
+
+// bump: updates a counter only its own thread writes but t_stats reads from
+// another. A relaxed store compiles to a plain one; it only rules out a torn
+// read.
+static inline void bump(size_t* counter, size_t delta) {
+    __atomic_store_n(counter, *counter + delta, __ATOMIC_RELAXED);
+}
+
+// thread_exit: returns every cached block to its arena and forgets the thread.
+// Frees from destructors that run after this one bypass the cache, which
+// nothing would flush again.
+static void thread_exit(void* arg) {
+    TCache* cache = (TCache*)arg;
+    cache->shut_down = 1;
+    if (cache->epoch == heap_epoch) {
+        for (int i = 0; i < TCACHE_BINS; i++) {
+            while (cache->bins[i] != NULL) {
+                void* ptr = cache->bins[i];
+                cache->bins[i] = *(void**)ptr;
+                release_block(ptr);
+            }
+            cache->counts[i] = 0;
+        }
+    }
+    bump(&cache->cached, -cache->cached);
+
+    pthread_mutex_lock(&threads_lock);
+    retired_allocs += cache->allocs;
+    retired_frees += cache->frees;
+    if (cache->prev != NULL) {
+        cache->prev->next = cache->next;
+    } else {
+        threads = cache->next;
+    }
+    if (cache->next != NULL) {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&threads_lock);
+}
+
+static void tcache_key_init(void) {
+    pthread_key_create(&tcache_key, thread_exit);
+}
+
+// thread_register: records the calling thread's stack and puts it on the list.
+static void thread_register(void) {
+    if (tcache.registered) {
+        return;
+    }
+    tcache.registered = 1;
+    pthread_attr_t attr;
+    void* stack;
+    size_t stack_size;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        pthread_attr_getstack(&attr, &stack, &stack_size);
+        pthread_attr_destroy(&attr);
+        tcache.stack_lo = stack;
+        tcache.stack_hi = (char*)stack + stack_size;
+    }
+    pthread_once(&tcache_once, tcache_key_init);
+    pthread_setspecific(tcache_key, &tcache);
+
+    pthread_mutex_lock(&threads_lock);
+    tcache.prev = NULL;
+    tcache.next = threads;
+    if (threads != NULL) {
+        threads->prev = &tcache;
+    }
+    threads = &tcache;
+    pthread_mutex_unlock(&threads_lock);
+}
+
+static void* tcache_get(size_t bin) {
+    if (tcache.epoch != heap_epoch || tcache.shut_down) {
+        return NULL;
+    }
+    void* ptr = tcache.bins[bin];
+    if (ptr != NULL) {
+        tcache.bins[bin] = *(void**)ptr;
+        tcache.counts[bin]--;
+        bump(&tcache.cached, -(bin * ALIGNMENT));
+        STAT(bump(&tcache.allocs, 1));
+    }
+    return ptr;
+}
+
+static int tcache_put(void* ptr, size_t bin) {
+    if (tcache.shut_down) {
+        return 0;
+    }
+    if (tcache.epoch != heap_epoch) {
+        // Anything cached before the last t_init belongs to a dead heap.
+        // A thread that only frees has never registered, so do it here.
+        thread_register();
+        memset(tcache.bins, 0, sizeof(tcache.bins));
+        memset(tcache.counts, 0, sizeof(tcache.counts));
+        bump(&tcache.cached, -tcache.cached);
+        __atomic_store_n(&tcache.epoch, heap_epoch, __ATOMIC_RELAXED);
+    }
+    if (tcache.counts[bin] >= TCACHE_COUNT) {
+        return 0;
+    }
+    *(void**)ptr = tcache.bins[bin];
+    tcache.bins[bin] = ptr;
+    tcache.counts[bin]++;
+    bump(&tcache.cached, bin * ALIGNMENT);
+    STAT(bump(&tcache.frees, 1));
+    return 1;
+}
+#endif
+
+// thread_stats: adds up what the thread caches hold and have served.
+void thread_stats(tdmm_stats_t* stats) {
+#ifdef TDMM_THREADS
+    pthread_mutex_lock(&threads_lock);
+    stats->cache_allocs = retired_allocs;
+    stats->cache_frees = retired_frees;
+    for (TCache* t = threads; t != NULL; t = t->next) {
+        if (__atomic_load_n(&t->epoch, __ATOMIC_RELAXED) == heap_epoch) {
+            stats->cached += __atomic_load_n(&t->cached, __ATOMIC_RELAXED);
+        }
+        stats->cache_allocs += __atomic_load_n(&t->allocs, __ATOMIC_RELAXED);
+        stats->cache_frees += __atomic_load_n(&t->frees, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&threads_lock);
+#else
+    (void)stats;
+#endif
+}
+
+// thread_arena: the arena this thread allocates from. Threads take arenas
+// round-robin the first time they allocate.
+static Arena* thread_arena(void) {
+#ifdef TDMM_THREADS
+    static __thread Arena* mine;
+    if (mine == NULL) {
+        unsigned int n = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+        mine = &arenas[n % MAX_ARENAS];
+        thread_register();
+    }
+    return mine;
+#else
+    return &arenas[0];
+#endif
+}
+
+
+// t_init: resets every arena and maps the first region of the heap.
+void t_init(alloc_strat_e strat) {
     current_strategy = strat;
-    srand(time(NULL));  
+    heap_epoch++;
+    region_reset();
+    slab_reset();
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        arena_reset(&arenas[i], i);
+    }
+    more_memory(thread_arena(), HEAP_SIZE);
+}
 
-    // Initialize the free list: the entire heap becomes one free block.
-    free_list = (Block*)heap_base;
-    free_list->size = HEAP_SIZE - METADATA;
-    free_list->is_free = 1;
-    free_list->next = NULL;
-    free_list->prev = NULL;
-    last_block = free_list;
-    round = FIRST; 
+void t_set_mmap_threshold(size_t size) {
+    mmap_threshold = size;
 }
 
-// t_malloc: allocates a block using the chosen strategy.
-void* t_malloc(size_t size) {
-    size = (size + 3) & ~3;
+void t_set_trim_threshold(size_t size) {
+    trim_threshold = size;
+}
+
+void t_set_thp_threshold(size_t size) {
+    thp_threshold = size;
+}
+
+// format_region: lays a fresh region out as one allocated block between
+// its pad and its fence, and returns the block.
+static Block* format_region(void* base, size_t size, int arena) {
+    Block* block = (Block*)((char*)base + PAD);
+    *block = (Block){.size = size - REGION_OVERHEAD, .first = 1, .arena = arena};
+    *NEXT(block) = (Block){.size = PAD, .arena = FENCE_ARENA};
+    return block;
+}
+
+// direct_alloc: gives a huge request a mapping of its own.
+static void* direct_alloc(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t length = (size + REGION_OVERHEAD + page - 1) & ~(page - 1);
+    void* base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    Block* block = format_region(base, length, DIRECT_ARENA);
+    __atomic_fetch_add(&direct_mapped, length, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&direct_payload, block->size, __ATOMIC_RELAXED);
+    STAT(__atomic_fetch_add(&direct_allocs, 1, __ATOMIC_RELAXED));
+    region_add(base, length);
+    return (char*)block + METADATA;
+}
+
+static void direct_free(Block* block) {
+    size_t length = block->size + REGION_OVERHEAD;
+    __atomic_fetch_sub(&direct_mapped, length, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&direct_payload, block->size, __ATOMIC_RELAXED);
+    STAT(__atomic_fetch_add(&direct_frees, 1, __ATOMIC_RELAXED));
+    region_remove((char*)block - PAD, length);
+    munmap((char*)block - PAD, length);
+}
 
+#ifndef TDMM_NO_STATS
+// search_bucket: the t_stats histogram bucket for a search of steps steps.
+static int search_bucket(size_t steps) {
+    int bucket = steps == 0 ? 0 : 64 - __builtin_clzll(steps);
+    return bucket < SEARCH_BUCKETS ? bucket : SEARCH_BUCKETS - 1;
+}
+#endif
+
+// arena_malloc: runs the chosen strategy; the caller holds the arena lock.
+static void* arena_malloc(Arena* arena, size_t size) {
+    void* ptr = NULL;
     if (current_strategy == FIRST_FIT) {
-        return first_fit(size);
+        ptr = first_fit(arena, size);
     } else if (current_strategy == BEST_FIT) {
-        return best_fit(size);
+        ptr = best_fit(arena, size);
     } else if (current_strategy == WORST_FIT) {
-        return worst_fit(size);
+        ptr = worst_fit(arena, size);
     } else if (current_strategy == SEQUENTIAL) {
-        return round_robin(size);
+        ptr = round_robin(arena, size);
     } else if (current_strategy == RANDOM) {
-        return random_fit(size);
+        ptr = random_fit(arena, size);
+    } else if (current_strategy == BUDDY) {
+        ptr = buddy_alloc(arena, size);
     }
-    return NULL;
+    if (ptr != NULL) {
+        arena->stats.in_use += ((Block*)((char*)ptr - METADATA))->size;
+        STAT(arena->stats.allocs[current_strategy]++);
+    }
+    STAT(arena->stats.search_steps += arena->stats.walk);
+    STAT(arena->stats.search_hist[search_bucket(arena->stats.walk)]++);
+    STAT(arena->stats.walk = 0);
+    return ptr;
 }
 
-void* split_block(Block* current, size_t size) {
-    size = (size + 3) & ~3;
+// request_size: the payload size t_malloc carves out for a request.
+static size_t request_size(size_t size) {
+    size = PAYLOAD_SIZE(size);
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
+    return size;
+}
 
+// t_malloc: serves small requests from slabs and the rest from a block
+// found with the chosen strategy.
+void* t_malloc(size_t size) {
+    if (size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    if (size <= SLAB_MAX) {
+        size_t cls = SLAB_CLASS(size);
+#ifdef TDMM_THREADS
+        void* cached = tcache_get(cls);
+        if (cached != NULL) {
+            return cached;
+        }
+#endif
+        Arena* arena = thread_arena();
+        LOCK(arena);
+        void* ptr = slab_alloc(arena, cls);
+        UNLOCK(arena);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    size = request_size(size);
+    if (mmap_threshold != 0 && size >= mmap_threshold) {
+        return direct_alloc(size);
+    }
+    if (current_strategy == BUDDY) {
+        size = buddy_round(size);
+    }
+
+    Arena* arena = thread_arena();
+    LOCK(arena);
+    void* ptr = arena_malloc(arena, size);
+    UNLOCK(arena);
+    return ptr;
+}
+
+// next_block: the header that follows block in its region, or in the next
+// region when they are adjacent. Buddy blocks each start with their own pad.
+Block* next_block(Block* block) {
+    Block* next = NEXT(block);
+    if (current_strategy == BUDDY && block->arena >= 0) {
+        next = (Block*)((char*)next + PAD);
+    }
+    return next;
+}
+
+/*
+ * The header of an allocated block is read without a lock by whoever holds
+ * the block (t_free, t_realloc, t_malloc_usable_size), while a thread that
+ * frees or splits the block in front of it flips its prev_free bit under
+ * the arena lock. Both sides go through the whole word atomically.
+ */
+typedef uint64_t __attribute__((may_alias)) HeaderWord;
+
+static inline Block load_header(Block* block) {
+    union { HeaderWord word; Block block; } h = {.word = __atomic_load_n((HeaderWord*)block, __ATOMIC_RELAXED)};
+    return h.block;
+}
+
+static inline void set_prev_free(Block* block, int value) {
+    union { Block block; HeaderWord word; } bit = {.block = {.prev_free = 1}};
+    if (value) {
+        __atomic_fetch_or((HeaderWord*)block, bit.word, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and((HeaderWord*)block, ~bit.word, __ATOMIC_RELAXED);
+    }
+}
+
+// footer: the last word of a free block's payload, which repeats its size.
+static size_t* footer(Block* block) {
+    return (size_t*)NEXT(block) - 1;
+}
+
+void* split_block(Arena* arena, Block* current, size_t size) {
     if (current == NULL) {
         return NULL;
     }
+    index_remove(arena, current);
     if (current->size >= size + METADATA + MIN_BLOCK_SIZE) {
         Block* new_block = (Block*)((char*)current + METADATA + size);
-        new_block->size = current->size - size - METADATA;
-        new_block->is_free = 1;
-        new_block->next = current->next;
-        new_block->prev = current;
-        current->next = new_block;
-        if (new_block->next != NULL) {
-            new_block->next->prev = new_block;
-        } else {
-            last_block = new_block;
-        }
+        *new_block = (Block){.size = current->size - size - METADATA,
+                             .is_free = 1, .arena = current->arena};
+        *footer(new_block) = new_block->size;
         current->size = size;
+        index_insert(arena, new_block);
+    } else {
+        set_prev_free(NEXT(current), 0);
     }
     current->is_free = 0;
     return (char*)current + METADATA;
 }
 
-void* round_robin(size_t size) {
-    if (round == FIRST) {
-        round = SECOND;
-        return first_fit(size);
-    } else if (round == SECOND) {
-        round = THIRD;
-        return best_fit(size);
+void* round_robin(Arena* arena, size_t size) {
+    if (arena->round == FIRST) {
+        arena->round = SECOND;
+        return first_fit(arena, size);
+    } else if (arena->round == SECOND) {
+        arena->round = THIRD;
+        return best_fit(arena, size);
     } else {  
-        round = FIRST;
-        return worst_fit(size);
+        arena->round = FIRST;
+        return worst_fit(arena, size);
     }
 }
 
-void* random_fit(size_t size) {
-    int random_number = rand() % 3; 
+void* random_fit(Arena* arena, size_t size) {
+    int random_number = rand_r(&arena->seed) % 3; 
     if (random_number == 0) {
-        return first_fit(size);
+        return first_fit(arena, size);
     } else if (random_number == 1) {
-        return best_fit(size);
+        return best_fit(arena, size);
     } else {  
-        return worst_fit(size);
+        return worst_fit(arena, size);
     }
 }
 
+// extend: grows the heap by room for size and carves the block from it.
+static void* extend(Arena* arena, size_t size) {
+    size_t needed = size + REGION_OVERHEAD;
+    return split_block(arena, more_memory(arena, HEAP_SIZE > needed ? HEAP_SIZE : needed), size);
+}
+
 // first_fit: finds the first free block that fits the requested size.
-void* first_fit(size_t size) {
-    Block* temp = free_list;
-    while (temp != NULL) {
-        if (temp->is_free && temp->size >= size) {
-            return split_block(temp, size);
-        }
-        temp = temp->next;
+void* first_fit(Arena* arena, size_t size) {
+    Block* temp = index_lowest_fit(arena, size);
+    if (temp != NULL) {
+        return split_block(arena, temp, size);
     }
-    size_t extend_size = (HEAP_SIZE > (size + METADATA + MIN_BLOCK_SIZE)) ?
-                         HEAP_SIZE : (size + METADATA + MIN_BLOCK_SIZE);
-    more_memory(extend_size);
-    return split_block(last_block, size);
+    return extend(arena, size);
 }
 
 // best_fit: finds the free block with the smallest leftover space.
-void* best_fit(size_t size) {
-    Block* temp = free_list;
-    Block* bestBlock = NULL;
-    while (temp != NULL) {
-        if (temp->is_free && temp->size >= size) {
-            if (bestBlock == NULL || temp->size < bestBlock->size) {
-                bestBlock = temp;
-            }
-        }
-        temp = temp->next;
-    }
+void* best_fit(Arena* arena, size_t size) {
+    Block* bestBlock = index_smallest_fit(arena, size);
     if (bestBlock == NULL) {
-        size_t extend_size = (HEAP_SIZE > (size + METADATA + MIN_BLOCK_SIZE)) ?
-                             HEAP_SIZE : (size + METADATA + MIN_BLOCK_SIZE);
-        more_memory(extend_size);
-        return split_block(last_block, size);
+        return extend(arena, size);
     }
-    return split_block(bestBlock, size);
+    return split_block(arena, bestBlock, size);
 }
 
 // worst_fit: finds the free block with the largest leftover space.
-void* worst_fit(size_t size) {
-    Block* temp = free_list;
+void* worst_fit(Arena* arena, size_t size) {
+    // The largest block is the root's subtree maximum; take its lowest copy.
     Block* worstBlock = NULL;
-    while (temp != NULL) {
-        if (temp->is_free && temp->size >= size) {
-            if (worstBlock == NULL || temp->size > worstBlock->size) {
-                worstBlock = temp;
-            }
+    if (arena->addr_root != NULL) {
+        worstBlock = index_lowest_fit(arena, NODE(arena->addr_root)->max_size);
+        if (worstBlock != NULL && worstBlock->size < size) {
+            worstBlock = NULL;
         }
-        temp = temp->next;
     }
     if (worstBlock == NULL) {
-        size_t extend_size = (HEAP_SIZE > (size + METADATA + MIN_BLOCK_SIZE)) ?
-                             HEAP_SIZE : (size + METADATA + MIN_BLOCK_SIZE);
-        more_memory(extend_size);
-        return split_block(last_block, size);
+        return extend(arena, size);
+    }
+    return split_block(arena, worstBlock, size);
+}
+
+// map_aligned: maps size bytes whose address is a multiple of align.
+static void* map_aligned(size_t size, size_t align) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (align <= page) {
+        return mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    char* raw = mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    char* aligned = (char*)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+    if (aligned > raw) {
+        munmap(raw, aligned - raw);
+    }
+    munmap(aligned + size, raw + align - aligned);
+    return aligned;
+}
+
+// heap_reserve: sets aside the arena's range on first use, aligned so huge
+// pages can back it. Only PROT_NONE address space until grow_heap commits it.
+static int heap_reserve(Arena* arena) {
+    if (arena->heap_end != NULL) {
+        return arena->heap != NULL;
+    }
+    char* raw = mmap(NULL, HEAP_RESERVE + HUGE_PAGE, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) {
+        arena->heap_end = (char*)-1;    // do not try again; map regions instead
+        return 0;
+    }
+    char* base = (char*)(((uintptr_t)raw + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+    if (base > raw) {
+        munmap(raw, base - raw);
+    }
+    munmap(base + HEAP_RESERVE, raw + HUGE_PAGE - base);
+    arena->heap = base;
+    arena->heap_top = base;
+    arena->heap_end = base + HEAP_RESERVE;
+    return 1;
+}
+
+// grow_heap: commits at least size more bytes of the arena's range and
+// returns them as a free block, merged with the last block if that is free.
+// Each step commits as much again as the heap already holds, up to
+// HEAP_MAX_STEP, so a heap of n bytes takes O(log n) calls to grow. The old
+// fence becomes the header of the new space. NULL once the range is used up.
+static Block* grow_heap(Arena* arena, size_t size) {
+    if (!heap_reserve(arena)) {
+        return NULL;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t committed = arena->heap_top - arena->heap;
+    size_t room = arena->heap_end - arena->heap_top;
+    size = (size + page - 1) & ~(page - 1);
+    size_t step = committed < HEAP_MAX_STEP ? committed : HEAP_MAX_STEP;
+    if (step < size) {
+        step = size;
+    }
+    if (step > room) {
+        step = size;
+    }
+    if (step > room || mprotect(arena->heap_top, step, PROT_READ | PROT_WRITE) != 0) {
+        return NULL;
+    }
+    if (thp_threshold != 0 && committed + step >= thp_threshold) {
+        madvise(arena->heap, committed + step, MADV_HUGEPAGE);
     }
-    return split_block(worstBlock, size);
+    arena->mapped += step;
+
+    Block* block;
+    if (committed == 0) {
+        region_add(arena->heap, step);
+        block = format_region(arena->heap, step, arena->id);
+    } else {
+        region_resize(arena->heap, committed + step);
+        block = (Block*)(arena->heap_top - METADATA);
+        *block = (Block){.size = step - METADATA, .prev_free = block->prev_free,
+                         .arena = arena->id};
+        *NEXT(block) = (Block){.size = PAD, .arena = FENCE_ARENA};
+        if (block->prev_free) {
+            Block* last = (Block*)((char*)block - METADATA - ((size_t*)block)[-1]);
+            index_remove(arena, last);
+            last->size += METADATA + block->size;
+            block = last;
+        }
+    }
+    arena->heap_top += step;
+    block->is_free = 1;
+    *footer(block) = block->size;
+    NEXT(block)->prev_free = 1;
+    index_insert(arena, block);
+    return block;
 }
 
-// more_memory: requests additional memory from the OS and appends it to the free list.
-void more_memory(size_t size) {
-    size = (size + 3) & ~3;
-    void* new_heap = mmap(NULL, size, PROT_READ | PROT_WRITE,
-                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+// more_memory: requests additional memory from the OS and returns it as a
+// free block, or NULL under BUDDY, where it goes on the buddy lists.
+// The fit strategies grow the arena's heap in place, and only map a region
+// of their own once its range is used up. Under BUDDY the region is a power
+// of two of at least 1MB, aligned to its own size, so whole regions rarely
+// empty and get unmapped.
+Block* more_memory(Arena* arena, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t align = 0;
+    if (current_strategy != BUDDY) {
+        Block* grown = grow_heap(arena, size);
+        if (grown != NULL) {
+            return grown;
+        }
+    }
+    if (current_strategy == BUDDY) {
+        if (size < BUDDY_MIN_REGION) {
+            size = BUDDY_MIN_REGION;
+        }
+        if ((size & (size - 1)) != 0) {
+            size = (size_t)1 << (64 - __builtin_clzll(size));
+        }
+        align = size;
+    } else {
+        size = (size + page - 1) & ~(page - 1);
+    }
+    void* new_heap = map_aligned(size, align);
     if (new_heap == MAP_FAILED) {
         perror("mmap failed to extend heap");
         exit(EXIT_FAILURE);
     }
-    Block* new_block = (Block*)new_heap;
-    new_block->size = size - METADATA;
+    arena->mapped += size;
+    region_add(new_heap, size);
+    if (current_strategy == BUDDY) {
+        buddy_add_region(arena, new_heap, size);
+        return NULL;
+    }
+    Block* new_block = format_region(new_heap, size, arena->id);
     new_block->is_free = 1;
-    new_block->next = NULL;
-    new_block->prev = NULL;
+    *footer(new_block) = new_block->size;
+    NEXT(new_block)->prev_free = 1;
+    index_insert(arena, new_block);
+    return new_block;
+}
+
+// unmap_region: returns a whole region to the OS.
+void unmap_region(Arena* arena, void* base, size_t size) {
+    arena->mapped -= size;
+    region_remove(base, size);
+    munmap(base, size);
+}
+
+// unlink_region: drops a whole-region free block from the arena.
+static void unlink_region(Arena* arena, Block* block) {
+    index_remove(arena, block);
+    unmap_region(arena, (char*)block - PAD, block->size + REGION_OVERHEAD);
+}
 
-    if (last_block != NULL) {
-        last_block->next = new_block;
-        new_block->prev = last_block;
+// trim_span: hands back to the OS the pages of [lo, hi), the part of a
+// large free block that a free has just added to it, keeping the block's
+// header, index links and footer resident. lo and hi are rounded outwards:
+// the whole block is free, so a page the added part only completes goes
+// back too, and a span that grows a little at a time is still released.
+// The cost follows what was freed, not the size of the span.
+void trim_span(Block* block, char* lo, char* hi) {
+    if (block->size < trim_threshold) {
+        return;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)NODE(block) + sizeof(FreeNode) + page - 1) & ~(page - 1);
+    uintptr_t last = (uintptr_t)footer(block) & ~(page - 1);
+    uintptr_t start = (uintptr_t)lo & ~(page - 1);
+    uintptr_t end = ((uintptr_t)hi + page - 1) & ~(page - 1);
+    if (start < first) {
+        start = first;
+    }
+    if (end > last) {
+        end = last;
+    }
+    if (end > start) {
+        madvise((void*)start, end - start, MADV_DONTNEED);
     }
-    last_block = new_block;
 }
 
-// t_free: frees a previously allocated block, coalescing adjacent free blocks.
-void t_free(void *ptr) {
-    if (ptr == NULL) {
+// shrink_heap: decommits the end of the arena's heap when block, a free
+// block just before the fence, has grown past twice trim_threshold. About
+// trim_threshold stays committed, so churn at the top does not grow and
+// shrink the heap on every call.
+static void shrink_heap(Arena* arena, Block* block) {
+    if (trim_threshold == SIZE_MAX || block->size / 2 < trim_threshold ||
+        (char*)NEXT(block) != arena->heap_top - METADATA) {
         return;
     }
-    Block* currBlock = (Block*)((char*)ptr - METADATA);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t keep = trim_threshold > MIN_BLOCK_SIZE + METADATA ? trim_threshold : MIN_BLOCK_SIZE + METADATA;
+    char* top = (char*)(((uintptr_t)NODE(block) + keep + page - 1) & ~(uintptr_t)(page - 1));
+    if (top >= arena->heap_top) {
+        return;
+    }
+    index_remove(arena, block);
+    decommit(top, arena->heap_top - top);
+    arena->mapped -= arena->heap_top - top;
+    arena->heap_top = top;
+    region_resize(arena->heap, top - arena->heap);
+    block->size = top - METADATA - (char*)NODE(block);
+    *footer(block) = block->size;
+    *NEXT(block) = (Block){.size = PAD, .prev_free = 1, .arena = FENCE_ARENA};
+    index_insert(arena, block);
+}
+
+// free_block: marks a block free, coalescing adjacent free blocks. The next
+// header follows the payload and a free block in front has left its size in
+// the word before this header, so both neighbours are found in O(1).
+static void free_block(Arena* arena, Block* currBlock) {
+    // What this free adds to the span for trim_span: the block itself and
+    // the metadata of the neighbours it absorbs, or a whole neighbour that
+    // was too small to be trimmed on its own.
+    char* lo = (char*)currBlock;
+    char* hi = (char*)NEXT(currBlock);
+
+    Block* nextBlock = NEXT(currBlock);
+    if (nextBlock->is_free) {
+        index_remove(arena, nextBlock);
+        hi = nextBlock->size < trim_threshold ? (char*)NEXT(nextBlock)
+                                              : (char*)NODE(nextBlock) + sizeof(FreeNode);
+        currBlock->size += METADATA + nextBlock->size;
+    }
+    if (currBlock->prev_free) {
+        Block* prevBlock = (Block*)((char*)currBlock - METADATA - ((size_t*)currBlock)[-1]);
+        index_remove(arena, prevBlock);
+        lo = prevBlock->size < trim_threshold ? (char*)prevBlock : lo - FOOTER;
+        prevBlock->size += METADATA + currBlock->size;
+        currBlock = prevBlock;
+    }
     currBlock->is_free = 1;
+    *footer(currBlock) = currBlock->size;
+    set_prev_free(NEXT(currBlock), 1);
 
-    if (currBlock->next != NULL && currBlock->next->is_free == 1 &&
-        (char*)currBlock + METADATA + currBlock->size == (char*)currBlock->next) {
-        Block* nextBlock = currBlock->next;
-        currBlock->size += nextBlock->size + METADATA;
-        currBlock->next = nextBlock->next;
-        if (nextBlock->next != NULL) {
-            nextBlock->next->prev = currBlock;
-        } else {
-            last_block = currBlock;
+    index_insert(arena, currBlock);
+
+    // A block that runs from the region's first header to its fence is the
+    // whole region. It becomes the arena's spare and the previous spare is
+    // unmapped, so one region stays mapped to absorb malloc/free churn at
+    // the margin. The heap itself stays; trim_span releases its pages.
+    if (currBlock->first && NEXT(currBlock)->arena == FENCE_ARENA &&
+        (char*)currBlock - PAD != arena->heap && trim_threshold != SIZE_MAX) {
+        if (arena->spare != NULL) {
+            unlink_region(arena, arena->spare);
         }
+        arena->spare = currBlock;
     }
-    if (currBlock->prev != NULL && currBlock->prev->is_free == 1 &&
-        (char*)currBlock->prev + METADATA + currBlock->prev->size == (char*)currBlock) {
-        Block* prevBlock = currBlock->prev;
-        prevBlock->size += currBlock->size + METADATA;
-        prevBlock->next = currBlock->next;
-        if (currBlock->next != NULL) {
-            currBlock->next->prev = prevBlock;
-        } else {
-            last_block = prevBlock;
+    shrink_heap(arena, currBlock);
+    trim_span(currBlock, lo, hi);
+}
+
+// release_block: hands an allocated block or slab slot back to the arena
+// that owns it.
+void release_block(void* ptr) {
+    if (IS_SLAB(ptr)) {
+        Arena* arena = &arenas[slab_arena(ptr)];
+        LOCK(arena);
+        slab_free(arena, ptr);
+        UNLOCK(arena);
+        return;
+    }
+    Block* block = (Block*)((char*)ptr - METADATA);
+    int owner = load_header(block).arena;
+    if (owner == DIRECT_ARENA) {
+        direct_free(block);
+        return;
+    }
+    Arena* arena = &arenas[owner];
+    LOCK(arena);
+    arena->stats.in_use -= block->size;
+    STAT(arena->stats.frees[current_strategy]++);
+    if (current_strategy == BUDDY) {
+        buddy_free(arena, ptr);
+    } else {
+        free_block(arena, block);
+    }
+    UNLOCK(arena);
+}
+
+// t_free: frees a previously allocated block, coalescing adjacent free
+// blocks. A slab object goes to the thread cache when there is room.
+void t_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (IS_SLAB(ptr)) {
+        size_t size;
+        ptr = slab_slot(ptr, &size);
+#ifdef TDMM_THREADS
+        if (tcache_put(ptr, size / ALIGNMENT)) {
+            return;
+        }
+#endif
+        release_block(ptr);
+        return;
+    }
+    Block header = load_header((Block*)((char*)ptr - METADATA));
+    if (header.arena == ALIGNED_ARENA) {
+        ptr = (char*)ptr - header.size;
+    }
+    release_block(ptr);
+}
+
+// t_calloc: t_malloc plus zeroing. Direct mappings come zeroed from the OS.
+void* t_calloc(size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    void* ptr = t_malloc(count * size);
+    if (ptr != NULL &&
+        (IS_SLAB(ptr) || load_header((Block*)((char*)ptr - METADATA)).arena != DIRECT_ARENA)) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+// direct_resize: moves a direct mapping to a new length with mremap, which
+// remaps the pages rather than copying them.
+static void* direct_resize(Block* block, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t length = block->size + REGION_OVERHEAD;
+    size_t new_length = (size + REGION_OVERHEAD + page - 1) & ~(page - 1);
+    if (new_length == length) {
+        return (char*)block + METADATA;
+    }
+    char* base = (char*)block - PAD;
+    void* moved = mremap(base, length, new_length, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED) {
+        return NULL;
+    }
+    region_remove(base, length);
+    region_add(moved, new_length);
+    __atomic_fetch_add(&direct_mapped, new_length - length, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&direct_payload, new_length - length, __ATOMIC_RELAXED);
+    return (char*)format_region(moved, new_length, DIRECT_ARENA) + METADATA;
+}
+
+// resize_block: grows or shrinks an arena block without moving it. Growth
+// absorbs the following block when it is free; whatever is left over past
+// size is split off and freed. Returns 0 if the block cannot hold size
+// bytes in place.
+static int resize_block(Block* block, size_t size) {
+    Arena* arena = &arenas[load_header(block).arena];
+    LOCK(arena);
+    if (current_strategy == BUDDY) {
+        // A buddy block cannot change order in place.
+        UNLOCK(arena);
+        return size <= block->size;
+    }
+    size_t old = block->size;
+    Block* next = NEXT(block);
+    if (size > block->size && next->is_free &&
+        block->size + METADATA + next->size >= size) {
+        index_remove(arena, next);
+        block->size += METADATA + next->size;
+        set_prev_free(NEXT(block), 0);
+    }
+    if (size > block->size) {
+        UNLOCK(arena);
+        return 0;
+    }
+    if (block->size >= size + METADATA + MIN_BLOCK_SIZE) {
+        Block* rest = (Block*)((char*)block + METADATA + size);
+        *rest = (Block){.size = block->size - size - METADATA, .arena = block->arena};
+        block->size = size;
+        free_block(arena, rest);
+    }
+    arena->stats.in_use += block->size - old;
+    UNLOCK(arena);
+    return 1;
+}
+
+// t_realloc: resizes in place when it can, otherwise copies to a new block.
+void* t_realloc(void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return t_malloc(size);
+    }
+    if (size == 0) {
+        t_free(ptr);
+        return NULL;
+    }
+    if (size > PTRDIFF_MAX) {
+        return NULL;
+    }
+    Block* block = (Block*)((char*)ptr - METADATA);
+    size_t want = request_size(size);
+    int owner = IS_SLAB(ptr) ? 0 : load_header(block).arena;
+    if (IS_SLAB(ptr)) {
+        if (size <= slab_usable_size(ptr)) {
+            return ptr;
         }
+    } else if (owner == DIRECT_ARENA) {
+        if (mmap_threshold != 0 && want >= mmap_threshold) {
+            void* moved = direct_resize(block, want);
+            if (moved != NULL) {
+                return moved;
+            }
+        }
+    } else if (owner != ALIGNED_ARENA &&
+               (mmap_threshold == 0 || want < mmap_threshold) &&
+               resize_block(block, want)) {
+        return ptr;
+    }
+
+    void* fresh = t_malloc(size);
+    if (fresh == NULL) {
+        return NULL;
+    }
+    size_t old = t_malloc_usable_size(ptr);
+    memcpy(fresh, ptr, old < size ? old : size);
+    t_free(ptr);
+    return fresh;
+}
+
+// t_aligned_alloc: over-allocates and hands out an aligned pointer inside
+// the block. The pointer gets a stub header (arena ALIGNED_ARENA) whose size
+// is its distance from the real payload, which is how t_free finds the
+// block again.
+void* t_aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return t_malloc(size);
+    }
+    if (alignment > PTRDIFF_MAX - METADATA || size > PTRDIFF_MAX - METADATA - alignment) {
+        return NULL;
+    }
+    char* real = t_malloc(size + alignment + METADATA);
+    if (real == NULL || ((uintptr_t)real & (alignment - 1)) == 0) {
+        return real;
+    }
+    char* ptr = (char*)(((uintptr_t)real + METADATA + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    *(Block*)(ptr - METADATA) = (Block){.size = ptr - real, .arena = ALIGNED_ARENA};
+    return ptr;
+}
+
+int t_posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* ptr = t_aligned_alloc(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+size_t t_malloc_usable_size(void* ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    if (IS_SLAB(ptr)) {
+        return slab_usable_size(ptr);
+    }
+    Block header = load_header((Block*)((char*)ptr - METADATA));
+    if (header.arena == ALIGNED_ARENA) {
+        size_t offset = header.size;
+        return t_malloc_usable_size((char*)ptr - offset) - offset;
+    }
+    return header.size;
+}
+
+// lock_arenas: stops every arena from changing, for t_gcollect.
+void lock_arenas(void) {
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        LOCK(&arenas[i]);
+    }
+}
+
+void unlock_arenas(void) {
+    for (int i = MAX_ARENAS - 1; i >= 0; i--) {
+        UNLOCK(&arenas[i]);
     }
 }
 
-// t_gcollect: Basic garbage collection (not implemented yet)
-void t_gcollect(void) {
-    // TODO: Implement garbage collection if needed.
-}
\ No newline at end of file
+// t_fork_prepare: takes every lock in libtdmm, in the order the collector
+// nests them, so no other thread holds one when the process forks.
+void t_fork_prepare(void) {
+    lock_arenas();
+    lock_regions();
+#ifdef TDMM_THREADS
+    pthread_mutex_lock(&threads_lock);
+#endif
+    lock_pool();
+}
+
+void t_fork_parent(void) {
+    unlock_pool();
+#ifdef TDMM_THREADS
+    pthread_mutex_unlock(&threads_lock);
+#endif
+    unlock_regions();
+    unlock_arenas();
+}
+
+// t_fork_child: the child has only the forking thread, which took the
+// locks, so it releases them the same way.
+void t_fork_child(void) {
+    t_fork_parent();
+}
+
+// visit_threads: reports the stack of every other registered thread and
+// every block sitting in any thread's cache.
+void visit_threads(void (*stack)(void* lo, void* hi), void (*cached)(void* ptr)) {
+#ifdef TDMM_THREADS
+    pthread_mutex_lock(&threads_lock);
+    for (TCache* t = threads; t != NULL; t = t->next) {
+        if (t != &tcache && t->stack_hi != NULL) {
+            stack(t->stack_lo, t->stack_hi);
+        }
+        if (t->epoch != heap_epoch) {
+            continue;
+        }
+        for (int i = 0; i < TCACHE_BINS; i++) {
+            for (void* ptr = t->bins[i]; ptr != NULL; ptr = *(void**)ptr) {
+                cached(ptr);
+            }
+        }
+    }
+    pthread_mutex_unlock(&threads_lock);
+#else
+    (void)stack;
+    (void)cached;
+#endif
+}
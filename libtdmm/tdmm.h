@@ -17,14 +17,49 @@ typedef enum
 	BUDDY
 } alloc_strat_e;
 
-typedef struct Block {
-		size_t size;        
-		int is_free;     
-		struct Block* next; 
-		struct Block* prev; 
-} Block;
-/**
- * Initializes the memory allocator with the given strategy.
+#define NUM_STRATEGIES (BUDDY + 1)
+#define SEARCH_BUCKETS 16
+
+/*
+ * Allocator statistics returned by t_stats. Byte counts are payload bytes
+ * unless noted; mapped - in_use - free - slab_free_bytes - cached is what
+ * headers, padding and split remainders cost. The counts are cumulative
+ * across t_init and are zero when libtdmm is built with TDMM_NO_STATS.
+ */
+typedef struct {
+	size_t mapped;          // bytes mapped from the OS, headers included
+	size_t in_use;          // held by the program
+	size_t free;            // in free blocks
+	size_t slab_free_bytes; // in free slots of slabs; only that class can use them
+	size_t cached;          // freed into a thread cache, not yet reused
+	size_t largest_free;    // the largest free block
+	double fragmentation;   // 1 - largest_free / free; 0 with one free block
+	size_t allocs[NUM_STRATEGIES];  // arena allocations under each strategy
+	size_t frees[NUM_STRATEGIES];   // blocks returned to an arena
+	size_t cache_allocs;    // t_malloc calls served by a thread cache
+	size_t cache_frees;     // t_free calls absorbed by a thread cache
+	size_t direct_allocs;   // requests given a mapping of their own
+	size_t direct_frees;
+	size_t slab_allocs;     // slots handed out by the slab layer
+	size_t slab_frees;
+	size_t search_steps;    // blocks/bins visited by all arena allocations
+	size_t search_hist[SEARCH_BUCKETS]; // arena allocations by blocks/bins
+	                        // visited: bucket 0 none, bucket k [2^(k-1), 2^k)
+} tdmm_stats_t;
+
+#define DIRECT_ARENA -1        // arena of a block that has its own mapping
+
+// One block as reported by t_walk.
+typedef struct {
+	void* addr;             // header address, or the slot of a slab object
+	size_t size;            // payload bytes
+	int is_free;
+	int arena;              // owning arena, or DIRECT_ARENA
+} tdmm_block_t;
+
+/**
+ * Initializes the memory allocator with the given strategy. Must not run
+ * concurrently with any other t_* call.
  * @param strat The strategy to use for memory allocation.
  */
 void t_init (alloc_strat_e strat);
@@ -44,25 +79,124 @@ void *t_malloc (size_t size);
  */
 void t_free (void *ptr);
 
+/**
+ * Allocates zeroed memory for an array.
+ * @param count The number of elements.
+ * @param size The size of each element.
+ * @return A pointer to the zeroed memory, or NULL if count * size overflows
+ * or the allocation fails.
+ */
+void *t_calloc (size_t count, size_t size);
+
+/**
+ * Resizes a block, keeping its contents up to the smaller of the two sizes.
+ * The block grows in place into a free neighbour when it can, and a block
+ * with its own mapping is resized with mremap; otherwise the contents are
+ * copied to a new block.
+ * @param ptr The block to resize, or NULL to allocate.
+ * @param size The new size. 0 frees the block and returns NULL.
+ * @return A pointer to the resized block, or NULL if it fails, in which case
+ * ptr is left untouched.
+ */
+void *t_realloc (void *ptr, size_t size);
+
+/**
+ * Allocates memory whose address is a multiple of alignment.
+ * @param alignment A power of two.
+ * @param size The size of the memory block to allocate.
+ * @return A pointer to the memory block, or NULL if alignment is not a power
+ * of two or the allocation fails.
+ */
+void *t_aligned_alloc (size_t alignment, size_t size);
+
+/**
+ * posix_memalign for libtdmm.
+ * @param memptr Receives the pointer on success.
+ * @param alignment A power of two multiple of sizeof(void*).
+ * @param size The size of the memory block to allocate.
+ * @return 0, EINVAL for a bad alignment or ENOMEM.
+ */
+int t_posix_memalign (void **memptr, size_t alignment, size_t size);
+
+/**
+ * @param ptr A pointer returned by one of the t_* allocation functions.
+ * @return The number of bytes usable at ptr, at least the size requested.
+ */
+size_t t_malloc_usable_size (void *ptr);
+
 /**
  * Performs basic garbage collection by scanning the stack and heap managed
- * by t_malloc and t_free.
+ * by t_malloc and t_free. The collector is conservative: any word on the
+ * calling thread's stack or registers, in a writable data/bss segment, or
+ * in a reachable block that points into a block's payload keeps it alive.
+ * Pointers held only in memory not managed by t_malloc are not seen.
+ * Other threads must be blocked outside t_* calls; their whole stacks are
+ * scanned, but their registers are not. A thread's stack is only known
+ * once the thread has allocated from libtdmm: a thread that holds a
+ * pointer it was handed but has never allocated is not scanned, and blocks
+ * only it refers to are freed.
  */
 void t_gcollect (void);
 
-void* split_block(Block* current, size_t size);
-void* first_fit(size_t size);
-void* worst_fit(size_t size);
-void* best_fit(size_t size);
-void more_memory(size_t size);
-void* round_robin(size_t size);
-void* random_fit(size_t size);
-enum RoundRobin{
-	FIRST,
-	SECOND,
-	THIRD
-};
+/**
+ * Sets the request size from which t_malloc gives a block its own mapping,
+ * which t_free unmaps straight away. 0 turns direct mappings off.
+ * @param size The threshold in bytes (default 128KB).
+ */
+void t_set_mmap_threshold (size_t size);
+
+/**
+ * Sets the size from which a free block's interior pages are handed back
+ * to the OS with MADV_DONTNEED. An arena's heap gives back its end once
+ * more than twice this much of it is free. Regions mapped outside the heap
+ * that become entirely free are unmapped regardless of size, except the
+ * most recent one in each arena.
+ * SIZE_MAX keeps all memory mapped.
+ * @param size The threshold in bytes (default 128KB).
+ */
+void t_set_trim_threshold (size_t size);
+
+/**
+ * Sets the heap size from which an arena asks for its heap to be backed by
+ * transparent huge pages (MADV_HUGEPAGE). Fewer TLB misses on large heaps,
+ * at the cost of memory rounded up to 2MB. 0 turns the hint off.
+ * @param size The threshold in bytes (default 0).
+ */
+void t_set_thp_threshold (size_t size);
+
+/**
+ * Reports how much memory libtdmm holds and how it is used. Reading the
+ * counters takes each arena's lock in turn, so the numbers are a snapshot
+ * only when no other thread is allocating.
+ * @return The current statistics.
+ */
+tdmm_stats_t t_stats (void);
+
+/**
+ * Calls visit for every block and slab slot in address order, direct
+ * mappings included. The layout is copied while the heap is locked and
+ * visit runs afterwards, so it may allocate.
+ * @param visit Called once per block.
+ * @param arg Passed through to visit.
+ * @return The number of blocks visited.
+ */
+size_t t_walk (void (*visit)(const tdmm_block_t* block, void* arg), void* arg);
 
+/**
+ * Writes the block layout from t_walk to out as CSV with the columns
+ * addr,size,state,arena, for offline analysis.
+ * @param out The stream to write to.
+ */
+void t_dump (FILE* out);
 
+/**
+ * Fork handlers for programs that fork while other threads allocate, e.g.
+ * pthread_atfork(t_fork_prepare, t_fork_parent, t_fork_child). prepare
+ * takes every lock libtdmm holds, so the child cannot inherit one that
+ * some other thread was holding.
+ */
+void t_fork_prepare (void);
+void t_fork_parent (void);
+void t_fork_child (void);
 
 #endif // TDMM_H_
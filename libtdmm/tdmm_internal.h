@@ -0,0 +1,171 @@
+#ifndef TDMM_INTERNAL_H_
+#define TDMM_INTERNAL_H_
+
+// Layout and internals shared by the libtdmm sources; not for clients.
+
+#include "tdmm.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define SMALL_LIMIT 1024
+#define NUM_BINS (SMALL_LIMIT >> 4)
+#define BUDDY_MAX_ORDER 47
+#define MAX_ARENAS 16
+
+#define ALIGNED_ARENA -2       // stub header in front of an over-aligned pointer
+#define FENCE_ARENA -3         // header that closes a region
+
+/*
+ * Every payload is 16-byte aligned and the 8-byte header sits right in front
+ * of it, so headers are 8 bytes off a 16-byte boundary. Each region starts
+ * with an 8-byte pad to get there and ends with a fence: an allocated header
+ * whose size of 8 steps over the pad of whatever region follows, so a walk
+ * from one block to the next runs straight through adjacent regions.
+ */
+#define ALIGNMENT 16
+#define PAD 8
+#define REGION_OVERHEAD (PAD + 2 * sizeof(Block))  // pad, first header, fence
+
+/*
+ * Requests up to SLAB_MAX bytes are served from slabs: SLAB_SIZE-aligned
+ * pages of equal slots without headers, one size class per 16 bytes.
+ */
+#define SLAB_SIZE 4096
+#define SLAB_MAX 512
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT)
+#define SLAB_CLASS(n) ((n) == 0 ? 1 : ((n) + ALIGNMENT - 1) / ALIGNMENT)
+
+// IS_SLAB: whether p points into the range slabs are carved from. slab_top
+// is loaded first: acquiring it makes the slab_lo written before it visible.
+#define IS_SLAB(p) ((char*)(p) < __atomic_load_n(&slab_top, __ATOMIC_ACQUIRE) && \
+                    (char*)(p) >= slab_lo)
+
+/*
+ * Header of every block. size is the payload, which runs up to the next
+ * header. A free block repeats its size in the last 8 bytes of its payload,
+ * and the next block's prev_free bit says that footer is there, so t_free
+ * finds both neighbours in O(1). Allocated blocks carry nothing but this
+ * word. Under BUDDY a block of order k spans 1 << k bytes aligned to its
+ * size, starting with its own pad, so size is (1 << k) - 16.
+ *
+ * size is a 48-bit field and GCC does arithmetic on it in 48 bits: widen
+ * it to size_t before negating it or subtracting something larger.
+ */
+typedef struct Block {
+		uint64_t size : 48;
+		uint64_t is_free : 1;
+		uint64_t prev_free : 1; // the block in front is free and has a footer
+		uint64_t first : 1;     // the first block of its region
+		int64_t arena : 6;      // index of the owning arena, or a *_ARENA value
+		uint64_t top_order : 6; // BUDDY: order of the region the block belongs to
+} Block;
+
+/*
+ * Free blocks keep their index links in the first bytes of the payload, so
+ * every block must have room for a FreeNode and a footer. All free blocks
+ * live in an address-ordered treap (first/worst fit); small ones also live
+ * in an exact-size bin and large ones in a size-ordered treap (best fit).
+ * Under BUDDY, link[0] and link[1] chain the free list of each order.
+ */
+typedef struct FreeNode {
+		struct Block* left;     // address treap children
+		struct Block* right;
+		size_t max_size;        // largest free size in this subtree
+		struct Block* link[2];  // bin next/prev, or size treap left/right
+} FreeNode;
+
+// Per-arena counters, updated under the arena lock.
+typedef struct ArenaStats {
+		size_t in_use;          // payload bytes of allocated blocks, cached ones included
+		size_t free;            // payload bytes of free blocks
+		size_t slab_free_bytes; // bytes of free slots in live slabs
+		size_t walk;            // steps taken by the search in progress
+		size_t allocs[NUM_STRATEGIES];
+		size_t frees[NUM_STRATEGIES];
+		size_t slab_allocs;
+		size_t slab_frees;
+		size_t search_steps;
+		size_t search_hist[SEARCH_BUCKETS];
+} ArenaStats;
+
+enum RoundRobin{
+	FIRST,
+	SECOND,
+	THIRD
+};
+
+/*
+ * An independent heap with its own lock. Threads are spread over the
+ * arenas in the order they first allocate, and a block is always returned
+ * to the arena recorded in its header, whichever thread frees it.
+ */
+typedef struct Arena {
+		pthread_mutex_t lock;
+		int id;
+		enum RoundRobin round;
+		unsigned int seed;      // rand_r state for random_fit
+		Block* bins[NUM_BINS];
+		uint64_t bin_map[NUM_BINS / 64];
+		Block* addr_root;
+		Block* size_root;
+		Block* buddy_lists[BUDDY_MAX_ORDER + 1];
+		uint64_t buddy_map;
+		size_t mapped;          // bytes of regions currently mapped
+		Block* spare;           // an entirely free region kept mapped
+		char* heap;             // reserved range the arena's blocks grow in
+		char* heap_top;         // end of the committed part
+		char* heap_end;
+		struct Slab* slabs[SLAB_CLASSES + 1]; // per class, the slabs with free slots
+		ArenaStats stats;
+} Arena;
+
+extern alloc_strat_e current_strategy;
+extern size_t trim_threshold;
+extern Arena arenas[MAX_ARENAS];
+extern size_t direct_mapped;
+extern size_t direct_payload;
+extern size_t direct_allocs;
+extern size_t direct_frees;
+extern char* slab_lo;
+extern char* slab_top;
+
+Block* next_block(Block* block);
+void* split_block(Arena* arena, Block* current, size_t size);
+void* first_fit(Arena* arena, size_t size);
+void* worst_fit(Arena* arena, size_t size);
+void* best_fit(Arena* arena, size_t size);
+Block* more_memory(Arena* arena, size_t size);
+void* round_robin(Arena* arena, size_t size);
+void* random_fit(Arena* arena, size_t size);
+void buddy_init(Arena* arena);
+void buddy_add_region(Arena* arena, void* base, size_t size);
+size_t buddy_round(size_t size);
+void* buddy_alloc(Arena* arena, size_t size);
+void buddy_free(Arena* arena, void* ptr);
+void unmap_region(Arena* arena, void* base, size_t size);
+void trim_span(Block* block, char* lo, char* hi);
+void release_block(void* ptr);
+void lock_arenas(void);
+void unlock_arenas(void);
+void lock_regions(void);
+void unlock_regions(void);
+void lock_pool(void);
+void unlock_pool(void);
+void visit_threads(void (*stack)(void* lo, void* hi), void (*cached)(void* ptr));
+void region_reset(void);
+void region_add(void* base, size_t size);
+void region_remove(void* base, size_t size);
+void region_resize(void* base, size_t size);
+void walk_spans(void (*visit)(char* base, char* end, void* arg), void* arg);
+void thread_stats(tdmm_stats_t* stats);
+void slab_reset(void);
+void* slab_alloc(Arena* arena, size_t cls);
+void slab_free(Arena* arena, void* ptr);
+void* slab_slot(void* ptr, size_t* size);
+int slab_arena(void* ptr);
+size_t slab_usable_size(void* ptr);
+void* slab_mark(void* p);
+void* slab_sweep(void* garbage);
+void slab_visit(void (*visit)(const tdmm_block_t* block, void* arg), void* arg);
+
+#endif // TDMM_INTERNAL_H_
@@ -5,10 +5,11 @@ import numpy as np
 import matplotlib.pyplot as plt
 from subprocess import call
 import random
+import glob
 
 # Compile the C code into a shared library
 if not os.path.exists("libtdmm.so"):
-    call(["gcc", "-shared", "-fPIC", "tdmm.c", "-o", "libtdmm.so"])
+    call(["gcc", "-shared", "-fPIC", *sorted(glob.glob("*.c")), "-o", "libtdmm.so"])
 
 # Load the shared library
 lib = ctypes.CDLL("./libtdmm.so")
@@ -21,18 +22,46 @@ lib.t_malloc.restype = ctypes.c_void_p
 lib.t_free.argtypes = [ctypes.c_void_p]
 lib.t_free.restype = None
 
+NUM_STRATEGIES = 6
+SEARCH_BUCKETS = 16
+
+# Mirrors tdmm_stats_t in tdmm.h
+class Stats(ctypes.Structure):
+    _fields_ = [
+        ("mapped", ctypes.c_size_t),
+        ("in_use", ctypes.c_size_t),
+        ("free", ctypes.c_size_t),
+        ("slab_free_bytes", ctypes.c_size_t),
+        ("cached", ctypes.c_size_t),
+        ("largest_free", ctypes.c_size_t),
+        ("fragmentation", ctypes.c_double),
+        ("allocs", ctypes.c_size_t * NUM_STRATEGIES),
+        ("frees", ctypes.c_size_t * NUM_STRATEGIES),
+        ("cache_allocs", ctypes.c_size_t),
+        ("cache_frees", ctypes.c_size_t),
+        ("direct_allocs", ctypes.c_size_t),
+        ("direct_frees", ctypes.c_size_t),
+        ("slab_allocs", ctypes.c_size_t),
+        ("slab_frees", ctypes.c_size_t),
+        ("search_steps", ctypes.c_size_t),
+        ("search_hist", ctypes.c_size_t * SEARCH_BUCKETS),
+    ]
+
+lib.t_stats.argtypes = []
+lib.t_stats.restype = Stats
+
 # Allocation strategies
-FIRST_FIT, BEST_FIT, WORST_FIT, SEQUENTIAL, RANDOM = 0, 1, 2, 3, 4
+FIRST_FIT, BEST_FIT, WORST_FIT, SEQUENTIAL, RANDOM, BUDDY = 0, 1, 2, 3, 4, 5
 STRATEGIES = {
     "First Fit": FIRST_FIT,
     "Best Fit": BEST_FIT,
     "Worst Fit": WORST_FIT,
     "Sequential": SEQUENTIAL,
-    "Random": RANDOM
+    "Random": RANDOM,
+    "Buddy": BUDDY
 }
 
 # Test parameters
-METADATA = 16
 REPEATS = 1
 NUM_TEST_CASES = 1000
 NUM_TEST_CASES_HIGH_CONCURRENCY = 200  # Reduced for HighConcurrency
@@ -43,19 +72,15 @@ def run_test(strategy, sizes, total_ops, num_mallocs, num_frees):
     alloc_times = []
     free_times = []
     utilization = []
-    total_allocated = 0
-    total_requested = 4096 * 4
     peak_overhead = 0
 
     operations = ['malloc'] * num_mallocs + ['free'] * num_frees
     np.random.shuffle(operations)
 
     start_time = time.perf_counter()
+    sampling = 0
 
     for op in operations:
-        current_overhead = (len(pointers) * METADATA) / total_requested * 100
-        peak_overhead = max(peak_overhead, current_overhead)
-
         if op == 'malloc':
             size = np.random.choice(sizes)
             t0 = time.perf_counter_ns()
@@ -64,10 +89,6 @@ def run_test(strategy, sizes, total_ops, num_mallocs, num_frees):
             alloc_times.append((size, (t1 - t0) / 1e9))
             if ptr:
                 pointers.append((ptr, size))
-                total_allocated += size + METADATA
-                if total_allocated > total_requested:
-                    new_chunk = max(4096 * 4, size + METADATA)
-                    total_requested += new_chunk
         elif op == 'free' and pointers:
             idx = np.random.randint(len(pointers))
             ptr, size = pointers.pop(idx)
@@ -75,11 +96,21 @@ def run_test(strategy, sizes, total_ops, num_mallocs, num_frees):
             lib.t_free(ptr)
             t1 = time.perf_counter_ns()
             free_times.append((size, (t1 - t0) / 1e9))
-            total_allocated -= (size + METADATA)
 
-        utilization.append((time.perf_counter() - start_time, total_allocated / total_requested))
+        # Headers, padding and split remainders are whatever the allocator
+        # has mapped that is neither handed out nor free. t_stats locks
+        # every arena, so its time is kept out of the timings.
+        s0 = time.perf_counter()
+        stats = lib.t_stats()
+        if stats.mapped:
+            overhead = (stats.mapped - stats.in_use - stats.free - stats.slab_free_bytes - stats.cached) / stats.mapped * 100
+            peak_overhead = max(peak_overhead, overhead)
+            utilization.append((s0 - start_time - sampling, stats.in_use / stats.mapped))
+        else:
+            utilization.append((s0 - start_time - sampling, 0))
+        sampling += time.perf_counter() - s0
 
-    total_time = time.perf_counter() - start_time
+    total_time = time.perf_counter() - start_time - sampling
     for ptr, _ in pointers:
         lib.t_free(ptr)
 
@@ -0,0 +1,272 @@
+#define _GNU_SOURCE  // PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+#include "tdmm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+// Interposes the C allocator with libtdmm so unmodified programs can be run
+// on it with LD_PRELOAD. The strategy comes from TDMM_STRATEGY (first, best,
+// worst, sequential, random or buddy; first by default).
+//
+// With TDMM_TRACE=<file> every call is also written to <file> in the format
+// tdmm_bench -t replays. A %p in the name is replaced by the process id, so
+// that programs which exec others do not write over their own trace.
+
+// glibc's malloc guarantees 16-byte alignment and compiled code relies on it.
+#define MALLOC_ALIGN 16
+
+static int ready;
+
+/*
+ * The trace lock is held across the whole call, not just the write, so a
+ * block freed by one thread and handed out again to another is recorded in
+ * the order it happened. It is recursive because libtdmm itself allocates
+ * while serving some calls (pthread_getattr_np when a thread registers).
+ */
+static int trace_fd = -1;
+static pthread_mutex_t trace_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static char trace_buf[1 << 16];
+static size_t trace_len;
+
+static void trace_flush(void) {
+    size_t done = 0;
+    while (done < trace_len) {
+        ssize_t n = write(trace_fd, trace_buf + done, trace_len - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    trace_len = 0;
+}
+
+static void trace_hex(uint64_t value) {
+    char digits[16];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[value & 15];
+        value >>= 4;
+    } while (value != 0);
+    trace_buf[trace_len++] = ' ';
+    while (n > 0) {
+        trace_buf[trace_len++] = digits[--n];
+    }
+}
+
+// trace_record: appends one line, op followed by count hex arguments.
+static void trace_record(char op, int count, uint64_t a, uint64_t b, uint64_t c) {
+    if (trace_len + 64 > sizeof(trace_buf)) {
+        trace_flush();
+    }
+    trace_buf[trace_len++] = op;
+    trace_hex(a);
+    if (count > 1) {
+        trace_hex(b);
+    }
+    if (count > 2) {
+        trace_hex(c);
+    }
+    trace_buf[trace_len++] = '\n';
+}
+
+static void trace_close(void) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        trace_flush();
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// trace_open: opens TDMM_TRACE, expanding %p, without allocating.
+static void trace_open(const char* pattern) {
+    char path[4096];
+    size_t len = 0;
+    for (const char* p = pattern; *p != '\0' && len + 24 < sizeof(path); p++) {
+        if (p[0] == '%' && p[1] == 'p') {
+            char digits[20];
+            int n = 0;
+            for (unsigned long pid = (unsigned long)getpid(); pid != 0 || n == 0; pid /= 10) {
+                digits[n++] = '0' + pid % 10;
+            }
+            while (n > 0) {
+                path[len++] = digits[--n];
+            }
+            p++;
+        } else {
+            path[len++] = *p;
+        }
+    }
+    path[len] = '\0';
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd >= 0) {
+        atexit(trace_close);
+    }
+}
+
+#define TRACE_BEGIN() \
+    int tracing = trace_fd >= 0; \
+    if (tracing) pthread_mutex_lock(&trace_lock)
+#define TRACE_END(op, count, a, b, c) \
+    if (tracing) { \
+        if (trace_fd >= 0) trace_record(op, count, (uint64_t)(a), (uint64_t)(b), (uint64_t)(c)); \
+        pthread_mutex_unlock(&trace_lock); \
+    }
+
+// A fork while another thread holds a libtdmm lock or the trace lock would
+// leave it held forever in the child. The child does not trace: its calls
+// would interleave with the parent's in the same file.
+static void fork_prepare(void) {
+    pthread_mutex_lock(&trace_lock);
+    t_fork_prepare();
+}
+
+static void fork_parent(void) {
+    t_fork_parent();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void fork_child(void) {
+    pthread_mutexattr_t attr;
+    t_fork_child();
+    trace_len = 0;
+    if (trace_fd >= 0) {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    // The lock is recursive and owned by the parent's thread id, so it cannot
+    // be unlocked here; start over with a fresh one.
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&trace_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// ensure_init: runs t_init on the first allocation, which happens before
+// the program can start a second thread. getenv does not allocate.
+static void ensure_init(void) {
+    if (ready) {
+        return;
+    }
+    ready = 1;
+    static const struct {
+        const char* name;
+        alloc_strat_e strat;
+    } names[] = {
+        {"first", FIRST_FIT}, {"best", BEST_FIT}, {"worst", WORST_FIT},
+        {"sequential", SEQUENTIAL}, {"random", RANDOM}, {"buddy", BUDDY},
+    };
+    alloc_strat_e strat = FIRST_FIT;
+    const char* env = getenv("TDMM_STRATEGY");
+    for (size_t i = 0; env != NULL && i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcasecmp(env, names[i].name) == 0) {
+            strat = names[i].strat;
+        }
+    }
+    t_init(strat);
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    env = getenv("TDMM_TRACE");
+    if (env != NULL && *env != '\0') {
+        trace_open(env);
+    }
+}
+
+// alloc_aligned: the allocation behind every entry point, at least
+// MALLOC_ALIGN aligned, setting errno the way malloc does.
+static void* alloc_aligned(size_t alignment, size_t size) {
+    void* ptr = t_aligned_alloc(alignment < MALLOC_ALIGN ? MALLOC_ALIGN : alignment, size);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* malloc(size_t size) {
+    ensure_init();
+    TRACE_BEGIN();
+    void* ptr = alloc_aligned(MALLOC_ALIGN, size);
+    TRACE_END('m', 2, size, ptr, 0);
+    return ptr;
+}
+
+void free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    TRACE_BEGIN();
+    t_free(ptr);
+    TRACE_END('f', 1, ptr, 0, 0);
+}
+
+void* calloc(size_t count, size_t size) {
+    ensure_init();
+    if (size != 0 && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    TRACE_BEGIN();
+    // t_calloc skips zeroing direct mappings, which come zeroed from the OS.
+    void* ptr = t_calloc(count, size);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    TRACE_END('m', 2, count * size, ptr, 0);
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    ensure_init();
+    TRACE_BEGIN();
+    void* moved;
+    if (ptr == NULL) {
+        moved = alloc_aligned(MALLOC_ALIGN, size);
+    } else {
+        moved = t_realloc(ptr, size);
+        if (moved == NULL && size != 0) {
+            errno = ENOMEM;
+        }
+    }
+    TRACE_END('r', 3, ptr, size, moved);
+    return moved;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    ensure_init();
+    TRACE_BEGIN();
+    void* ptr = alloc_aligned(alignment, size);
+    TRACE_END('m', 2, size, ptr, 0);
+    return ptr;
+}
+
+void* memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+// posix_memalign: reports failure only through its result; errno is left
+// as the caller had it.
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    ensure_init();
+    int saved = errno;
+    TRACE_BEGIN();
+    int err = t_posix_memalign(memptr, alignment, size);
+    TRACE_END('m', 2, size, err == 0 ? *memptr : NULL, 0);
+    errno = saved;
+    return err;
+}
+
+void* valloc(size_t size) {
+    return aligned_alloc((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+void* pvalloc(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void* ptr) {
+    return t_malloc_usable_size(ptr);
+}